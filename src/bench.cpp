@@ -0,0 +1,316 @@
+// Headless benchmarks of the editing engine: File edits, cursor moves and
+// the line scans under them, over synthetic corpora from 1 KB up to 1 GB.
+// Built without SDL by `make bench`, which prints one JSON object:
+// ns/op and allocations/op per operation, load time and RSS per corpus,
+// and the throughput of the byte scans over each corpus's text.
+//
+//   fate-bench [--min-bytes=N] [--max-bytes=N] [--time-ms=N] [--dir=PATH]
+//              [--undo-budget=BYTES]
+#define FATE_HEADLESS
+#define FATE_TRACE 0
+#include "profiler.cpp"
+#include "file.cpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+// Reaches the private line-scan helpers and places the cursor directly.
+struct FileBench {
+    static size_t countTotalLines(File& f) {
+        return f.count_total_lines();
+    }
+    static size_t lineStart(File& f, size_t pos) {
+        return f.get_line_start(pos);
+    }
+    static void moveTo(File& f, size_t pos) {
+        f.cursor = f.anchor = pos;
+        f.update_row_col();
+    }
+    static size_t size(File& f) {
+        return f.size;
+    }
+};
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// xorshift64*, so every run sees the same corpora and positions.
+struct Random {
+    unsigned long long state;
+    explicit Random(unsigned long long seed) : state(seed) {}
+    unsigned long long next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+    size_t below(size_t n) {
+        return n ? next() % n : 0;
+    }
+};
+
+enum Corpus { LINES, JSON, MIXED };
+const char* const CORPUS_NAMES[] = {"lines", "json", "mixed"};
+
+const char* const WORDS[] = {"int", "size_t", "return", "if", "for", "while", "auto", "const",
+    "std::vector", "data", "cursor", "line", "=", "+", "(", ")", "{", "}", ";", "0", "1", "nullptr"};
+
+void appendWords(std::string& out, Random& rng, size_t length) {
+    size_t end = out.size() + length;
+    while (out.size() < end) {
+        out += WORDS[rng.below(sizeof(WORDS) / sizeof(WORDS[0]))];
+        out += ' ';
+    }
+}
+
+// Next piece of a corpus. Short lines are 20-60 byte code-like lines; json
+// is one minified line that never ends; mixed interleaves indented code,
+// blank lines and the occasional multi-kilobyte line.
+void generate(Corpus kind, Random& rng, std::string& out) {
+    out.clear();
+    switch (kind) {
+        case LINES:
+            while (out.size() < 65536) {
+                appendWords(out, rng, 20 + rng.below(40));
+                out += '\n';
+            }
+            break;
+        case JSON:
+            while (out.size() < 65536) {
+                out += "{\"id\":" + std::to_string(rng.next() % 100000) + ",\"name\":\"";
+                appendWords(out, rng, 8 + rng.below(24));
+                out += "\",\"tags\":[\"a\",\"b\"],\"ok\":true},";
+            }
+            break;
+        case MIXED:
+            while (out.size() < 65536) {
+                size_t r = rng.below(100);
+                if (r < 10) {
+                    out += '\n';
+                    continue;
+                }
+                out.append(4 * rng.below(4), ' ');
+                appendWords(out, rng, r < 97 ? 10 + rng.below(100) : 2000 + rng.below(8000));
+                out += '\n';
+            }
+            break;
+    }
+}
+
+bool writeCorpus(const std::string& path, Corpus kind, size_t bytes) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    Random rng(0x5eed + kind);
+    std::string piece;
+    for (size_t written = 0; written < bytes;) {
+        generate(kind, rng, piece);
+        size_t n = std::min(piece.size(), bytes - written);
+        if (fwrite(piece.data(), 1, n, out) != n) {
+            fclose(out);
+            return false;
+        }
+        written += n;
+    }
+    return fclose(out) == 0;
+}
+
+long residentKb() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return -1;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(statm);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+long peakResidentKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct Result {
+    const char* name;
+    size_t ops;
+    double nsPerOp, allocationsPerOp;
+};
+
+// Runs op(i) for i = 0, 1, ... until budget has passed, checking the clock
+// every few calls so the check stays out of the measurement.
+template<class Op>
+Result measure(const char* name, clock_type::duration budget, Op&& op) {
+    unsigned long long allocations = allocationCount.load(std::memory_order_relaxed);
+    clock_type::time_point start = clock_type::now(), now = start;
+    size_t ops = 0;
+    while (now - start < budget && ops < (1u << 24)) {
+        for (size_t i = 0; i < 16; i++) op(ops++);
+        now = clock_type::now();
+    }
+    double ns = std::chrono::duration<double, std::nano>(now - start).count();
+    double allocated = allocationCount.load(std::memory_order_relaxed) - allocations;
+    return {name, ops, ns / ops, allocated / ops};
+}
+
+std::vector<Result> run(File& f, clock_type::duration budget) {
+    std::vector<Result> results;
+    BufferSnapshot journal;
+    Random rng(42);
+    size_t middle = FileBench::size(f) / 2;
+    auto at = [&](size_t pos) { FileBench::moveTo(f, std::min(pos, FileBench::size(f))); };
+    auto anywhere = [&] { return rng.below(FileBench::size(f) + 1); };
+    // Without a view to take the line edits they pile up in the journal.
+    auto add = [&](Result r) { results.push_back(r); f.snapshot(journal); };
+
+    at(middle);
+    add(measure("insert", budget, [&](size_t) { f.insert('x'); }));
+    add(measure("remove", budget, [&](size_t) { f.remove(); }));
+    at(middle);
+    add(measure("insert_newline", budget, [&](size_t) { f.insert('\n'); }));
+    add(measure("insert_random", budget, [&](size_t) { at(anywhere()); f.insert('y'); }));
+    add(measure("remove_random", budget, [&](size_t) { at(anywhere()); f.remove(); }));
+    at(middle);
+    add(measure("move", budget, [&](size_t i) {
+        static const Direction order[] = {RIGHT, DOWN, LEFT, UP};
+        f.move(order[(i / 64) % 4]);
+    }));
+    add(measure("count_total_lines", budget, [&](size_t) {
+        volatile size_t n = FileBench::countTotalLines(f);
+        (void)n;
+    }));
+    add(measure("update_row_col", budget, [&](size_t) { at(anywhere()); }));
+    add(measure("get_line_start", budget, [&](size_t) {
+        volatile size_t start = FileBench::lineStart(f, anywhere());
+        (void)start;
+    }));
+    at(middle);
+    add(measure("mixed", budget, [&](size_t) {
+        size_t r = rng.below(100);
+        if (r < 60) {
+            f.insert('z');
+        } else if (r < 70) {
+            f.remove();
+        } else if (r < 75) {
+            f.insert('\n');
+        } else {
+            f.move((Direction)rng.below(4));
+        }
+    }));
+    return results;
+}
+
+struct ScanResult {
+    const char* name;
+    double gbPerS;
+};
+
+// Whole passes of each scan over text, best of those fitting in budget
+// (at least one).
+std::vector<ScanResult> runScans(const char* text, size_t size, clock_type::duration budget) {
+    std::vector<ScanResult> results;
+    auto pass = [&](const char* name, auto&& fn) {
+        double best = 0;
+        clock_type::time_point start = clock_type::now(), now = start;
+        while (best == 0 || now - start < budget) {
+            clock_type::time_point t = now;
+            volatile size_t n = fn();
+            (void)n;
+            now = clock_type::now();
+            double ns = std::chrono::duration<double, std::nano>(now - t).count();
+            best = std::max(best, ns > 0 ? size / ns : 0);
+        }
+        results.push_back({name, best});
+    };
+    pass("count_newlines", [&] { return scan::count_byte(text, size, '\n'); });
+    pass("count_codepoints", [&] { return scan::count_codepoints(text, size); });
+    pass("newline_offsets", [&] {
+        size_t last = 0;
+        scan::for_each_newline(text, size, [&](size_t nl) { last = nl; });
+        return last;
+    });
+    pass("line_index_assign", [&] {
+        LineIndex lines;
+        lines.assign(text, size);
+        return lines.lines();
+    });
+    return results;
+}
+
+size_t argument(int argc, char** argv, const char* name, size_t fallback) {
+    size_t len = strlen(name);
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return strtoull(argv[i] + len + 1, nullptr, 10);
+    }
+    return fallback;
+}
+
+std::string stringArgument(int argc, char** argv, const char* name, const std::string& fallback) {
+    size_t len = strlen(name);
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') return argv[i] + len + 1;
+    }
+    return fallback;
+}
+
+}
+
+int main(int argc, char** argv) {
+    size_t minBytes = argument(argc, argv, "--min-bytes", 1 << 10);
+    size_t maxBytes = argument(argc, argv, "--max-bytes", 1 << 30);
+    auto budget = std::chrono::milliseconds(argument(argc, argv, "--time-ms", 200));
+    size_t undoBudget = argument(argc, argv, "--undo-budget", 64 << 20);
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = stringArgument(argc, argv, "--dir", tmp && *tmp ? tmp : "/tmp");
+    std::string path = dir + "/fate-bench-" + std::to_string(getpid()) + ".txt";
+    printf("{\"scan_kernels\":\"%s\",\"corpora\":[", scan::kernels().name);
+    bool first = true;
+    for (size_t bytes = minBytes; bytes <= maxBytes && bytes > 0; bytes *= 32) {
+        for (int kind = LINES; kind <= MIXED; kind++) {
+            if (!writeCorpus(path, (Corpus)kind, bytes)) {
+                fprintf(stderr, "fate-bench: can't write %s\n", path.c_str());
+                unlink(path.c_str());
+                return 1;
+            }
+            fprintf(stderr, "%s %zu bytes\n", CORPUS_NAMES[kind], bytes);
+            unsigned long long allocations = allocationCount.load(std::memory_order_relaxed);
+            clock_type::time_point start = clock_type::now();
+            std::vector<Result> results;
+            long rss;
+            {
+                File f(path, nullptr);
+                f.setUndoBudget(undoBudget);
+                double loadNs = std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+                unsigned long long loadAllocations = allocationCount.load(std::memory_order_relaxed) - allocations;
+                rss = residentKb();
+                printf("%s\n{\"corpus\":\"%s\",\"bytes\":%zu,\"lines\":%zu,\"load_ns\":%.0f,\"load_allocations\":%llu,\"rss_kb\":%ld,\"ops\":[",
+                    first ? "" : ",", CORPUS_NAMES[kind], bytes, f.lineCount(), loadNs, loadAllocations, rss);
+                first = false;
+                results = run(f, budget);
+            }
+            for (size_t i = 0; i < results.size(); i++) {
+                const Result& r = results[i];
+                printf("%s\n  {\"op\":\"%s\",\"count\":%zu,\"ns_per_op\":%.1f,\"allocations_per_op\":%.2f}",
+                    i ? "," : "", r.name, r.ops, r.nsPerOp, r.allocationsPerOp);
+            }
+            printf("],\"rss_after_kb\":%ld,\"scans\":[", residentKb());
+            std::unique_ptr<MappedFile> mapped(MappedFile::open(path));
+            if (mapped) {
+                std::vector<ScanResult> scans = runScans(mapped->data(), mapped->size(), budget);
+                for (size_t i = 0; i < scans.size(); i++) {
+                    printf("%s\n  {\"scan\":\"%s\",\"gb_per_s\":%.2f}", i ? "," : "", scans[i].name, scans[i].gbPerS);
+                }
+            }
+            printf("]}");
+            fflush(stdout);
+            unlink(path.c_str());
+        }
+    }
+    printf("\n],\"peak_rss_kb\":%ld}\n", peakResidentKb());
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CHANNEL
+#define CHANNEL
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single-producer single-consumer ring of N slots. Slots are
+// filled and read in place and never destroyed, so whatever a slot owns
+// (vector capacity, say) is reused on the next lap instead of reallocated.
+// The indices only ever grow; each sits on its own cache line so the two
+// threads don't bounce one line between them.
+template<class T,size_t N>
+class Channel {
+    static_assert(N>0&&(N&(N-1))==0,"N must be a power of two");
+    T slots[N];
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+public:
+    // Producer: the slot to fill next, nullptr while the ring is full.
+    T* back() {
+        size_t t=tail.load(std::memory_order_relaxed);
+        if (t-head.load(std::memory_order_acquire)==N) return nullptr;
+        return &slots[t%N];
+    }
+    // Producer: hands the slot from back() to the consumer.
+    void push() {
+        tail.store(tail.load(std::memory_order_relaxed)+1,std::memory_order_release);
+    }
+    // Consumer: the oldest published slot, nullptr if there is none.
+    T* front() {
+        size_t h=head.load(std::memory_order_relaxed);
+        if (h==tail.load(std::memory_order_acquire)) return nullptr;
+        return &slots[h%N];
+    }
+    // Consumer: gives the slot from front() back to the producer.
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed)+1,std::memory_order_release);
+    }
+};
+#endif
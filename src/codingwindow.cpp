@@ -1,61 +1,355 @@
 #include "drawing.cpp"
 #include "file.cpp"
-#include <SDL2/SDL_render.h>
+#include "channel.cpp"
+#include "textview.cpp"
+#include "framescheduler.cpp"
+#include "perfhud.cpp"
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+#include <atomic>
+#include <cstdio>
 #include <iostream>
-#include <ostream>
+#include <memory>
 #include <string>
-#include <fontconfig/fontconfig.h>
+#include "fontresolver.cpp"
 std::string font_family_to_path(const std::string& family) {
-    FcInit();
-    FcPattern* pat = FcPatternCreate();
-    FcPatternAddString(pat, FC_FAMILY, (FcChar8*)family.c_str());
-    FcConfigSubstitute(NULL, pat, FcMatchPattern);
-    FcDefaultSubstitute(pat);
-    FcResult result;
-    FcPattern* font = FcFontMatch(NULL, pat, &result);
-    std::string path;
-    if (font) {
-        FcChar8* file = nullptr;
-        if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch) {
-            path = (char*)file;
-        }
-        FcPatternDestroy(font);
-    }
-    FcPatternDestroy(pat);
-    FcFini();
-    return path;
+    return FontResolver::instance().resolve(family);
 }
+// An editor pane split across three threads. The thread that owns the
+// window takes in events and hands them over in batches through a channel,
+// since SDL only lets it read events, render and touch the clipboard. An
+// edit thread applies each batch to the File as it arrives, however long
+// a frame takes to draw, and publishes a snapshot after it. A TextView on
+// a layout thread takes the snapshots in order when the FrameScheduler
+// says to, lays out and records what changed, then waits while the
+// window's thread draws and presents it. In between each sleeps on a
+// semaphore.
 class CodingWindow {
     Window* window;
-    int fontSize,fontIndex;
-    std::string fontFamily;
     File f;
-    Texture t;
-    SDL_Color bg={35,33,54,255};
-    SDL_Color fg={250,244,237,255};
+    std::string fontPath;
+    int fontSize;
+    int width,height;
+    FrameScheduler::Options frameOptions;
+    int refreshRate;
+    // Where each presented frame is written as frame-NNNNNN.png, if set.
+    std::string frameDir;
+    size_t framesCaptured=0;
+    // Made and destroyed on the window's thread; between a post of ready
+    // and one of drawn they are its to draw, otherwise the layout thread's.
+    std::unique_ptr<TextView> view;
+    std::unique_ptr<PerfHud> hud;
+    Channel<InputBatch,16> inputs;
+    Channel<BufferSnapshot,16> snapshots;
+    SDL_sem* arrived;
+    SDL_sem* wake;
+    SDL_sem* ready;
+    SDL_sem* drawn;
+    FrameScheduler::clock::time_point submittedAt,presentedAt;
+    SDL_Thread* editor=nullptr;
+    SDL_Thread* thread=nullptr;
+    std::atomic<bool> quit{false},stopped{false};
+    // The window's thread's: set while there is input to send but no free
+    // slot, F3 presses and arrow repeats not yet sent (two presses cancel
+    // out), batches sent, and the copies on the clipboard.
+    bool sending=false;
+    bool hudToggle=false;
+    int repeats[4]={};
+    size_t sent=0;
+    size_t copiesSet=0;
+    // The edit thread's: what the batches applied since the last snapshot
+    // said besides the edits.
+    InputBatch carried;
+    // The edit thread's last copy, for the window's thread to put on the
+    // clipboard.
+    SDL_mutex* clipLock;
+    std::string clipText;
+    size_t clipCopies=0;
+    // Batches applied; set while there is something to publish but no
+    // free slot; snapshots pushed, and those the layout thread is done with.
+    std::atomic<size_t> applied{0};
+    std::atomic<bool> pending{false};
+    std::atomic<size_t> published{0},shown{0};
+    static int editMain(void* self) {
+        ((CodingWindow*)self)->editLoop();
+        return 0;
+    }
+    void editLoop() {
+        TRACE_THREAD("edit");
+        size_t copiesShared = 0;
+        while (!quit.load(std::memory_order_acquire)) {
+            size_t taken = 0;
+            {
+                ScopedZone zone(ZONE_EDIT);
+                while (InputBatch* b = inputs.front()) {
+                    f.update(*b);
+                    carried.keystrokes.insert(carried.keystrokes.end(), b->keystrokes.begin(), b->keystrokes.end());
+                    carried.scrollY += b->scrollY;
+                    carried.width = b->width;
+                    carried.height = b->height;
+                    carried.pixelWidth = b->pixelWidth;
+                    carried.pixelHeight = b->pixelHeight;
+                    carried.exposed = carried.exposed || b->exposed;
+                    carried.toggleHud ^= b->toggleHud;
+                    inputs.pop();
+                    taken++;
+                }
+            }
+            if (taken) shareCopy(copiesShared);
+            publish();
+            applied.fetch_add(taken, std::memory_order_release);
+            if (pending.load(std::memory_order_relaxed)) SDL_SemWaitTimeout(arrived, 1);
+            else SDL_SemWait(arrived);
+        }
+    }
+    // Hands a copy made since the last call to the window's thread.
+    void shareCopy(size_t& copiesShared) {
+        SDL_LockMutex(clipLock);
+        size_t copies = f.lastCopy(copiesShared, clipText);
+        bool fresh = copies != copiesShared;
+        clipCopies = copiesShared = copies;
+        SDL_UnlockMutex(clipLock);
+        if (fresh) window->wake();
+    }
+    // Puts what the edit thread copied last on the clipboard, once.
+    void syncClipboard() {
+        SDL_LockMutex(clipLock);
+        if (clipCopies != copiesSet) {
+            SDL_SetClipboardText(clipText.c_str());
+            copiesSet = clipCopies;
+        }
+        SDL_UnlockMutex(clipLock);
+    }
+    static bool wantsPaste(const std::vector<InputEvent>& input) {
+        for (const InputEvent& e : input) {
+            if (e.type == InputEvent::KEY && (e.key.mod & KMOD_CTRL) && e.key.sym == SDLK_v) return true;
+        }
+        return false;
+    }
+    static int layoutMain(void* self) {
+        ((CodingWindow*)self)->layoutLoop();
+        return 0;
+    }
+    void layoutLoop() {
+        TRACE_THREAD("layout");
+        FrameScheduler frames(refreshRate, frameOptions);
+        while (!quit.load(std::memory_order_acquire)) {
+            // Whatever arrives while this waits makes it into the frame.
+            frames.waitForStart();
+            Timer frame(false);
+            TRACE_BEGIN(ZONE_NAMES[ZONE_FRAME]);
+            frames.begin();
+            bool redraw = false;
+            size_t taken = 0;
+            while (BufferSnapshot* s = snapshots.front()) {
+                view->apply(*s);
+                for (auto t : s->keystrokes) frames.keystroke(t);
+                if (s->toggleHud) hud->visible = !hud->visible;
+                redraw = redraw || s->toggleHud;
+                snapshots.pop();
+                taken++;
+            }
+            view->update();
+            if (view->needsRender() || redraw) {
+                view->prepare();
+                size_t hits, misses;
+                view->glyphStats(hits, misses);
+                hud->prepare(hits, misses);
+                SDL_SemPost(ready);
+                window->wake();
+                SDL_SemWait(drawn);
+                if (quit.load(std::memory_order_acquire)) {
+                    TRACE_END(ZONE_NAMES[ZONE_FRAME]);
+                    break;
+                }
+                frames.submitted(submittedAt);
+                frames.presented(presentedAt);
+                Profiler::instance().zone(ZONE_FRAME).add(frame.nanos());
+                TRACE_COUNTER("allocations", allocationCount.load(std::memory_order_relaxed));
+                TRACE_COUNTER("glyph misses", misses);
+            }
+            TRACE_END(ZONE_NAMES[ZONE_FRAME]);
+            shown.fetch_add(taken, std::memory_order_release);
+            int wait = view->nextDeadline();
+            if (wait < 0) SDL_SemWait(wake);
+            else SDL_SemWaitTimeout(wake, wait);
+        }
+        stopped.store(true, std::memory_order_release);
+    }
+    // Draws and presents the frame the layout thread has ready, waiting up
+    // to timeout ms for one.
+    void draw(Uint32 timeout = 0) {
+        if ((timeout ? SDL_SemWaitTimeout(ready, timeout) : SDL_SemTryWait(ready)) != 0) return;
+        window->clear({30, 30, 30, 255});
+        view->draw();
+        hud->draw(window);
+        if (!frameDir.empty()) captureFrame();
+        submittedAt = FrameScheduler::clock::now();
+        {
+            ScopedZone zone(ZONE_PRESENT);
+            window->present();
+        }
+        presentedAt = FrameScheduler::clock::now();
+        SDL_SemPost(drawn);
+    }
+    void captureFrame() {
+        TRACE_SCOPE("capture");
+        char name[32];
+        snprintf(name, sizeof(name), "/frame-%06zu.png", framesCaptured++);
+        if (window->capture(frameDir + name)) return;
+        std::cerr << "Can't write " << frameDir << name << ": " << SDL_GetError() << std::endl;
+        frameDir.clear();
+    }
+    // Sends the input taken in since the last batch to the edit thread, if
+    // a slot is free; sending says whether that is still to do.
+    void send() {
+        static const SDL_Scancode arrows[4] = {SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT};
+        bool repeated = false;
+        for (int d = 0; d < 4; d++) {
+            repeats[d] += window->keys.autoRepeats(arrows[d]);
+            repeated = repeated || repeats[d];
+        }
+        if (window->input.empty() && window->keystrokes.empty() && !window->scrollY && !window->dirty && !hudToggle && !repeated) {
+            sending = false;
+            return;
+        }
+        InputBatch* b = inputs.back();
+        sending = !b;
+        if (!b) return;
+        if (window->dirty) window->updatePixelSize(window->Width(), window->Height());
+        b->input.swap(window->input);
+        b->inputText.swap(window->inputText);
+        window->clearInput();
+        b->keystrokes.swap(window->keystrokes);
+        window->keystrokes.clear();
+        for (int d = 0; d < 4; d++) {
+            b->repeats[d] = repeats[d];
+            repeats[d] = 0;
+        }
+        b->shift = window->keys.shift();
+        b->copies = copiesSet;
+        b->hasClipboard = false;
+        if (wantsPaste(b->input) && SDL_HasClipboardText()) {
+            char* clip = SDL_GetClipboardText();
+            if (clip) {
+                b->clipboard = clip;
+                b->hasClipboard = true;
+            }
+            SDL_free(clip);
+        }
+        b->scrollY = window->scrollY;
+        b->width = window->Width();
+        b->height = window->Height();
+        b->pixelWidth = window->PixelWidth();
+        b->pixelHeight = window->PixelHeight();
+        b->exposed = window->dirty;
+        b->toggleHud = hudToggle;
+        hudToggle = false;
+        window->scrollX = window->scrollY = 0;
+        window->dirty = false;
+        inputs.push();
+        sent++;
+        SDL_SemPost(arrived);
+    }
+    // Sends what changed since the last snapshot to the layout thread, if
+    // a slot is free; pending says whether that is still to do.
+    void publish() {
+        if (!f.isDirty() && !carried.scrollY && !carried.exposed && !carried.toggleHud) {
+            // Keys that changed nothing never get presented.
+            carried.keystrokes.clear();
+            pending.store(false, std::memory_order_relaxed);
+            return;
+        }
+        BufferSnapshot* s = snapshots.back();
+        pending.store(!s, std::memory_order_relaxed);
+        if (!s) return;
+        f.snapshot(*s);
+        s->keystrokes.swap(carried.keystrokes);
+        carried.keystrokes.clear();
+        s->moved = f.isDirty();
+        s->scrollY = carried.scrollY;
+        s->width = carried.width;
+        s->height = carried.height;
+        s->pixelWidth = carried.pixelWidth;
+        s->pixelHeight = carried.pixelHeight;
+        s->exposed = carried.exposed;
+        s->toggleHud = carried.toggleHud;
+        f.clean();
+        carried.scrollY = 0;
+        carried.exposed = carried.toggleHud = false;
+        snapshots.push();
+        published.fetch_add(1, std::memory_order_release);
+        SDL_SemPost(wake);
+    }
 public:
-    CodingWindow(std::string filename,Window* w,int width,int height,int size,std::string family):
-        f(filename,w),t(w->getRenderer(),width,height),fontSize(size),fontFamily(family) {
-        fontIndex=t.loadFont(font_family_to_path(fontFamily),fontSize);
-        window=w;
+    CodingWindow(std::string filename,Window* w,int width,int height,int size,std::string family,FrameScheduler::Options frameOptions={},std::string frameDir=""):
+        window(w),f(filename,w),fontPath(font_family_to_path(family)),fontSize(size),width(width),height(height),
+        frameOptions(frameOptions),refreshRate(w->refreshRate()),frameDir(frameDir) {
+        arrived=SDL_CreateSemaphore(0);
+        wake=SDL_CreateSemaphore(0);
+        ready=SDL_CreateSemaphore(0);
+        drawn=SDL_CreateSemaphore(0);
+        clipLock=SDL_CreateMutex();
+        if (!window->createRenderer(width, height, !frameOptions.unlocked)) {
+            stopped.store(true, std::memory_order_release);
+            return;
+        }
+        view.reset(new TextView(window, Document(f.getrope(), f.lineIndex()), fontPath, fontSize, width, height));
+        hud.reset(new PerfHud(window->getRenderer(), fontPath, std::max(8, fontSize * 3 / 4)));
+        carried.width = window->Width();
+        carried.height = window->Height();
+        carried.pixelWidth = window->PixelWidth();
+        carried.pixelHeight = window->PixelHeight();
+        thread=SDL_CreateThread(layoutMain,"layout",this);
+        editor=SDL_CreateThread(editMain,"edit",this);
+    }
+    CodingWindow(const CodingWindow&)=delete;
+    CodingWindow& operator=(const CodingWindow&)=delete;
+    ~CodingWindow() {
+        quit.store(true, std::memory_order_release);
+        SDL_SemPost(arrived);
+        SDL_SemPost(wake);
+        SDL_SemPost(drawn);
+        if (editor) SDL_WaitThread(editor, nullptr);
+        if (thread) SDL_WaitThread(thread, nullptr);
+        SDL_DestroySemaphore(arrived);
+        SDL_DestroySemaphore(wake);
+        SDL_DestroySemaphore(ready);
+        SDL_DestroySemaphore(drawn);
+        SDL_DestroyMutex(clipLock);
+        hud.reset();
+        view.reset();
+        window->destroyRenderer();
     }
+    // Sends the input gathered since the last call to the edit thread and
+    // draws the frame the layout thread has ready, if any. While the edit
+    // thread is so far behind that the channel is full, the input stays in
+    // the window and F3 and the arrow repeats here until a slot frees up.
     void update() {
-        f.updateFromWindow();
-    }
-    void render() {
-        t.clear(bg);
-        t.setColor(fg);
-        auto mouse=f.mousePos();
-        int charWidth = 0, charHeight = 0;
-        TTF_SizeText(t.getFont(fontIndex), "M", &charWidth, &charHeight);
-        int lineHeight = TTF_FontLineSkip(t.getFont(fontIndex));
-        t.drawRect(
-            mouse.first * charWidth,
-            mouse.second * lineHeight,
-            2,
-            lineHeight
-        );
-        t.drawText(f.getrope(),0,0,fontIndex,t.Width(),t.Height(),fg);
-        window->drawTexture(t);
+        hudToggle ^= window->keys.pressed(SDL_SCANCODE_F3);
+        syncClipboard();
+        send();
+        draw();
+    }
+    // Sends what is left and draws until it is all applied and on screen,
+    // so that a replay ends with its last keystrokes there.
+    void finish() {
+        while (!stopped.load(std::memory_order_acquire) && (sending || applied.load(std::memory_order_acquire) < sent
+               || pending.load(std::memory_order_relaxed)
+               || shown.load(std::memory_order_acquire) < published.load(std::memory_order_acquire))) {
+            if (sending) send();
+            draw(1);
+        }
+    }
+    // Only before the first update(); the edit thread has the File after.
+    size_t lineCount() const {
+        return f.lineCount();
+    }
+    // Milliseconds until update() should run again without new input: soon
+    // while a batch is waiting for a slot, otherwise never (-1). A frame
+    // ready to draw, or a copy to put on the clipboard, wakes the window's
+    // waitEvents itself.
+    int nextDeadline() {
+        return sending ? 1 : -1;
     }
 };
@@ -0,0 +1,88 @@
+#ifndef DOCUMENT
+#define DOCUMENT
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ext/rope>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lineindex.cpp"
+#include "ropechunks.cpp"
+typedef __gnu_cxx::crope rope;
+
+// What the window's thread publishes to the layout thread: the text (copying a
+// crope only bumps a refcount, and the copy never changes), the cursor, the
+// line edits since the previous snapshot, and the window input the view
+// follows. lens holds the lengths of the lines each edit inserted, in
+// order, and keystrokes the arrival times of the key downs behind it.
+struct BufferSnapshot {
+    rope text;
+    size_t cursor=0,anchor=0;
+    std::vector<LineEdit> edits;
+    std::vector<size_t> lens;
+    std::vector<std::chrono::steady_clock::time_point> keystrokes;
+    // The cursor moved or the text changed.
+    bool moved=false;
+    int scrollY=0;
+    // The window's size in points and its drawable's in pixels.
+    int width=0,height=0;
+    int pixelWidth=0,pixelHeight=0;
+    // Something other than the buffer needs the window repainted.
+    bool exposed=false;
+    // F3 was pressed: show or hide the performance HUD.
+    bool toggleHud=false;
+};
+
+// The layout thread's copy of a buffer. It keeps a line index of its own,
+// brought up to date from the snapshots' line edits, so it never reads
+// the File the window's thread is changing.
+class Document {
+    rope text;
+    LineIndex lines;
+    size_t cursor=0,anchor=0;
+    std::vector<size_t> replaced;
+public:
+    Document(const rope& text,const LineIndex& lines): text(text),lines(lines) {}
+    void apply(const BufferSnapshot& s) {
+        const size_t* len=s.lens.data();
+        for (const LineEdit& e:s.edits) {
+            if (e.removed==e.inserted) {
+                for (size_t i=0;i<e.inserted;i++) lines.resize(e.first+i,(long)len[i]-(long)lines.length(e.first+i));
+            } else {
+                replaced.assign(len,len+e.inserted);
+                lines.replace(e.first,e.removed,replaced);
+            }
+            len+=e.inserted;
+        }
+        text=s.text;
+        cursor=s.cursor;
+        anchor=s.anchor;
+    }
+    size_t lineCount() const {
+        return lines.lines();
+    }
+    // Length of a line without its '\n'.
+    size_t lineLength(size_t line) const {
+        size_t len=lines.length(line);
+        return line+1<lines.lines()?len-1:len;
+    }
+    void lineText(size_t line,std::string& out) const {
+        size_t start=lines.start(line);
+        out.clear();
+        append_range(text,start,start+lineLength(line),out);
+    }
+    // (col,row) of an offset.
+    std::pair<size_t,size_t> position(size_t offset) const {
+        size_t line=lines.lineOf(offset);
+        return {offset-lines.start(line),line};
+    }
+    std::pair<int,int> mousePos() const {
+        auto p=position(cursor);
+        return {(int)p.first,(int)p.second};
+    }
+    std::pair<size_t,size_t> selection() const {
+        return {std::min(anchor,cursor),std::max(anchor,cursor)};
+    }
+};
+#endif
@@ -10,12 +10,18 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL2_gfxPrimitives.h>
 #include <SDL2/SDL_video.h>
+#include <chrono>
 #include <ostream>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <iostream>
-#include <unordered_map>
 #include <vector>
 #include "texture.cpp"
+#include "keyboard.cpp"
+#include "profiler.cpp"
+#include "session.cpp"
 bool operator==(const SDL_Rect& one,const SDL_Rect& other) {
     return one.x == other.x && one.y == other.y && one.w==other.w && one.h==other.h;
 }
@@ -52,30 +58,78 @@ bool collide(SDL_Rect r1,SDL_Rect r2) {
     if (r1.x+r1.w>r2.x && r2.x+r2.w>r1.x && r1.y+r1.h>r2.y && r2.y+r2.h>r1.y) return true;
     return false;
 }
-void setFrameRate(int targetFPS) {
-    static Uint32 lastTime = 0;
-    Uint32 frameTime = 1000 / targetFPS;
-    Uint32 currentTime = SDL_GetTicks();
-    Uint32 deltaTime = currentTime - lastTime;
-    if (deltaTime < frameTime) {
-        SDL_Delay(frameTime - deltaTime);
-    }
-    lastTime = SDL_GetTicks();
-}
+// Keystrokes in arrival order. Consecutive SDL_TEXTINPUT events are joined
+// into one TEXT entry, a range of Window::inputText; KEY entries are key
+// downs, OS repeats included and marked.
+struct InputEvent {
+    enum Type { TEXT, KEY } type;
+    size_t begin,len;
+    SDL_Keysym key;
+    bool repeat=false;
+};
+// What the window's thread hands the thread that edits, per pass of its
+// loop: the keystrokes, how often each held arrow repeated, the clipboard
+// if a paste wants it, and what the view needs to know besides the text.
+struct InputBatch {
+    std::vector<InputEvent> input;
+    std::string inputText;
+    std::vector<std::chrono::steady_clock::time_point> keystrokes;
+    // Indexed by Direction.
+    int repeats[4]={};
+    bool shift=false;
+    // The clipboard, read for a paste, and how many of the edit thread's
+    // copies the window's thread had put on it by then.
+    bool hasClipboard=false;
+    std::string clipboard;
+    size_t copies=0;
+    int scrollY=0;
+    int width=0,height=0;
+    int pixelWidth=0,pixelHeight=0;
+    bool exposed=false;
+    bool toggleHud=false;
+    std::string_view text(const InputEvent& e) const {
+        return std::string_view(inputText).substr(e.begin,e.len);
+    }
+};
 
 class Window {
     SDL_Window* window = nullptr;
     SDL_Renderer* renderer = nullptr;
     SDL_Color curcolor;
     int width,height;
+    int pixelWidth,pixelHeight;
+    bool headless;
+    // Posted by wake(); never handled or recorded.
+    Uint32 wakeEvent = (Uint32)-1;
+    // Reused by every capture of the same size.
+    SDL_Surface* captureSurface = nullptr;
     //std::vector<Texture*> textures;
 public:
     int mouseX,mouseY; Uint32 buttons;
-    int scrollX,scrollY;
-    std::unordered_map<int,int> keyspressed;
+    int scrollX=0,scrollY=0;
+    Keyboard keys;
+    std::vector<InputEvent> input;
+    std::string inputText;
+    // When each key down came in, for input-to-present latency.
+    std::vector<std::chrono::steady_clock::time_point> keystrokes;
     int running=1;
-    Window(const std::string& title,int width,int height): width(width),height(height) {
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
+    bool dirty=true;
+    // Events handled are written to recorder; while player is set, events
+    // come from it instead of SDL, and time runs on its clock.
+    SessionWriter* recorder=nullptr;
+    SessionReader* player=nullptr;
+    // A headless window is hidden, on SDL's offscreen video driver (dummy
+    // where that isn't built in) unless SDL_VIDEODRIVER says otherwise,
+    // and renders in software, so it runs without a display or GPU and
+    // its frames come out the same on any machine.
+    Window(const std::string& title,int width,int height,bool headless=false): width(width),height(height),pixelWidth(width),pixelHeight(height),headless(headless) {
+        if (headless) setenv("SDL_VIDEODRIVER","offscreen",0);
+        int init=SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
+        if (init != 0 && headless && strcmp(getenv("SDL_VIDEODRIVER"),"offscreen") == 0) {
+            setenv("SDL_VIDEODRIVER","dummy",1);
+            init=SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
+        }
+        if (init != 0) {
             std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
             return;
         }
@@ -87,69 +141,181 @@ public:
             std::cerr << "IMG_Init Error: " << IMG_GetError() << std::endl;
             return;
         }
-        window = SDL_CreateWindow(title.c_str(),SDL_WINDOWPOS_UNDEFINED,SDL_WINDOWPOS_UNDEFINED,width,height,SDL_WINDOW_SHOWN|SDL_WINDOW_RESIZABLE);
+        Uint32 flags = (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN)|SDL_WINDOW_RESIZABLE|SDL_WINDOW_ALLOW_HIGHDPI;
+        window = SDL_CreateWindow(title.c_str(),SDL_WINDOWPOS_UNDEFINED,SDL_WINDOWPOS_UNDEFINED,width,height,flags);
         if (!window) {
             std::cerr << "SDL_CreateWindow Error: " << SDL_GetError() << std::endl;
             return;
         }
-        renderer = SDL_CreateRenderer(window,-1,SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        wakeEvent = SDL_RegisterEvents(1);
+        SDL_StartTextInput();
+    }
+    // SDL wants the window and the renderer, and everything drawn with it,
+    // on the thread that created the window; other threads only prepare
+    // what that one draws.
+    bool createRenderer(int pointWidth,int pointHeight,bool vsync=true) {
+        Uint32 flags = headless ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED;
+        renderer = SDL_CreateRenderer(window,-1,flags | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
         if (!renderer) {
             std::cerr << "SDL_CreateRenderer Error: " << SDL_GetError() << std::endl;
-            return;
+            return false;
+        }
+        updatePixelSize(pointWidth,pointHeight);
+        return true;
+    }
+    void destroyRenderer() {
+        if (captureSurface) SDL_FreeSurface(captureSurface);
+        captureSurface = nullptr;
+        if (renderer) SDL_DestroyRenderer(renderer);
+        renderer = nullptr;
+    }
+    bool isHeadless() const {
+        return headless;
+    }
+    // Writes what has been drawn since the last present to a PNG, before
+    // present().
+    bool capture(const std::string& path) {
+        if (captureSurface && (captureSurface->w != pixelWidth || captureSurface->h != pixelHeight)) {
+            SDL_FreeSurface(captureSurface);
+            captureSurface = nullptr;
+        }
+        if (!captureSurface) captureSurface = SDL_CreateRGBSurfaceWithFormat(0,pixelWidth,pixelHeight,32,SDL_PIXELFORMAT_ARGB8888);
+        if (!captureSurface) return false;
+        if (SDL_RenderReadPixels(renderer,nullptr,SDL_PIXELFORMAT_ARGB8888,captureSurface->pixels,captureSurface->pitch) != 0) return false;
+        return IMG_SavePNG(captureSurface,path.c_str()) == 0;
+    }
+    // The renderer's output in pixels, for a window of the given size in
+    // points; it differs on high-DPI displays. A headless window has no
+    // window manager to resize it, so this does.
+    void updatePixelSize(int pointWidth,int pointHeight) {
+        int w,h;
+        if (headless) {
+            SDL_GetWindowSize(window,&w,&h);
+            if (w!=pointWidth||h!=pointHeight) SDL_SetWindowSize(window,pointWidth,pointHeight);
+        }
+        if (!renderer||SDL_GetRendererOutputSize(renderer,&pixelWidth,&pixelHeight)!=0) {
+            pixelWidth=pointWidth;
+            pixelHeight=pointHeight;
         }
     }
     SDL_Renderer* getRenderer() {
         return renderer;
     }
+    // Refresh rate of the window's display in Hz, 0 if unknown.
+    int refreshRate() {
+        SDL_DisplayMode mode;
+        if (SDL_GetWindowDisplayMode(window,&mode)!=0) return 0;
+        return mode.refresh_rate;
+    }
     SDL_Rect windowDimensions() {
         return {0,0,width,height};
     }
+    // Milliseconds on the window's clock, for key repeats and deadlines.
+    Uint32 ticks() {
+        return player ? player->ticks() : SDL_GetTicks();
+    }
+    // Makes waitEvents return soon. Safe from any thread.
+    void wake() {
+        if (wakeEvent == (Uint32)-1) return;
+        SDL_Event e{};
+        e.type = wakeEvent;
+        SDL_PushEvent(&e);
+    }
+    void handleEvent(SDL_Event& e) {
+        if (e.type==wakeEvent) return;
+        if (recorder) recorder->write(e);
+        if (e.type==SDL_QUIT) {
+            running=false;
+        }
+        if (e.type==SDL_KEYDOWN) {
+            keystrokes.push_back(std::chrono::steady_clock::now());
+            keys.keyDown(e.key.keysym.scancode);
+            input.push_back({InputEvent::KEY,0,0,e.key.keysym,e.key.repeat!=0});
+        } else if (e.type==SDL_TEXTINPUT) {
+            size_t len=strlen(e.text.text);
+            if (input.empty()||input.back().type!=InputEvent::TEXT) {
+                input.push_back({InputEvent::TEXT,inputText.size(),0,{}});
+            }
+            inputText.append(e.text.text,len);
+            input.back().len+=len;
+        } else if (e.type==SDL_KEYUP) {
+            keys.keyUp(e.key.keysym.scancode);
+        } else if (e.type==SDL_MOUSEWHEEL) {
+            scrollX+=e.wheel.x;
+            scrollY+=e.wheel.y;
+        } else if (e.type==SDL_WINDOWEVENT) {
+            if (e.window.event==SDL_WINDOWEVENT_SIZE_CHANGED) {
+                width=e.window.data1;
+                height=e.window.data2;
+            }
+            dirty=true;
+        }
+    }
     void pollEvents() {
+        waitEvents(0);
+    }
+    // Blocks for up to timeout ms (forever if negative) until an event
+    // arrives, then drains the queue.
+    void waitEvents(int timeout) {
         SDL_Event e;
-        for (auto& i:keyspressed) {
-            if (i.second!=0) i.second++;
+        if (player) {
+            replayEvents(timeout);
+            return;
         }
+        bool woken=timeout!=0&&SDL_WaitEventTimeout(&e,timeout);
+        ScopedZone zone(ZONE_POLL);
+        if (recorder) recorder->mark();
+        keys.beginFrame(ticks());
+        if (woken) handleEvent(e);
         while (SDL_PollEvent(&e)) {
-            if (e.type==SDL_QUIT) {
-                running=false;
-            }
-            if (e.type==SDL_KEYDOWN) {
-                if (keyspressed[e.key.keysym.sym]==0) keyspressed[e.key.keysym.sym]=1;
-            } else if (e.type==SDL_KEYUP) {
-                keyspressed[e.key.keysym.sym]=0;
-            } else if (e.type==SDL_MOUSEWHEEL) {
-                scrollX+=e.wheel.x;
-                scrollY+=e.wheel.y;
-            }
+            handleEvent(e);
         }
         buttons=SDL_GetMouseState(&mouseX, &mouseY);
-        SDL_GetWindowSize(window,&width,&height);
+    }
+    // waitEvents for a replay, which ends when the session does. Real SDL
+    // events are dropped, but still cut a real-time wait short.
+    void replayEvents(int timeout) {
+        SDL_Event e;
+        player->advance(timeout,[&](int ms) { return SDL_WaitEventTimeout(&e,ms) != 0; });
+        ScopedZone zone(ZONE_POLL);
+        if (recorder) recorder->mark();
+        keys.beginFrame(ticks());
+        while (player->poll(e)) handleEvent(e);
+        while (SDL_PollEvent(&e)) {}
+        if (player->done()) running=false;
+    }
+    // Keeps the buffers' capacity so steady typing doesn't allocate.
+    void clearInput() {
+        input.clear();
+        inputText.clear();
     }
     ~Window() {
-        SDL_DestroyRenderer(renderer);
+        destroyRenderer();
         SDL_DestroyWindow(window);
         IMG_Quit();
         TTF_Quit();
         SDL_Quit();
     }
+    // Each overload flushes what was recorded into t before copying it.
     void drawTexture(Texture& t,SDL_Rect img,SDL_Rect win) {
+        t.flush();
         SDL_Texture* te=t.getTexture();
         SDL_Texture* texture = te;
         SDL_RenderCopy(renderer,texture,&img,&win);
     }
     void drawTexture(Texture& t,SDL_Rect win) {
+        t.flush();
         SDL_Texture* te=t.getTexture();
         SDL_Texture* texture = te;
-        SDL_Rect img{0,0,0,0};
-        SDL_QueryTexture(texture,NULL,NULL,&img.w,&img.h);
+        SDL_Rect img{0,0,t.Width(),t.Height()};
         SDL_RenderCopy(renderer,texture,&img,&win);
     }
     void drawTexture(Texture& t) {
+        t.flush();
         SDL_Texture* te=t.getTexture();
         SDL_Texture* texture = te;
-        SDL_Rect img{0,0,0,0};
-        SDL_Rect win{0,0,width,height};
-        SDL_QueryTexture(texture,NULL,NULL,&img.w,&img.h);
+        SDL_Rect img{0,0,t.Width(),t.Height()};
+        SDL_Rect win{0,0,pixelWidth,pixelHeight};
         SDL_RenderCopy(renderer,texture,&img,&win);
     }
     int Width() {
@@ -158,6 +324,13 @@ public:
     int Height() {
         return height;
     }
+    // Size of the drawable in pixels, what textures should be sized to.
+    int PixelWidth() {
+        return pixelWidth;
+    }
+    int PixelHeight() {
+        return pixelHeight;
+    }
     void present() {
         SDL_RenderPresent(renderer);
     }
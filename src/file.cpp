@@ -1,52 +1,71 @@
 #ifndef FILE_HANDLER
 #define FILE_HANDLER
+// FATE_HEADLESS leaves out the window input and the clipboard, so the
+// editing engine builds without SDL (see bench.cpp).
+#ifndef FATE_HEADLESS
 #include "drawing.cpp"
 #include <SDL2/SDL_keycode.h>
-#include <climits>
+#else
+class Window;
+#endif
+#include "document.cpp"
+#include "lineindex.cpp"
+#include "mappedfile.cpp"
+#include "history.cpp"
+#include "profiler.cpp"
+#include "ropechunks.cpp"
+#include "scan.cpp"
+#include "trace.cpp"
+#include <algorithm>
 #include <ext/rope>
 #include <fstream>
 #include <iostream>
 #include <ostream>
 #include <sstream>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <utility>
 typedef __gnu_cxx::crope rope;
 enum Direction { UP, DOWN, LEFT, RIGHT };
-#define SPEED 2
-#define BREAK 30
-bool Pressed(int num) {
-    if (num==1) return num;
-    if (num>=BREAK&&((num-BREAK)%SPEED==0)) return 1;
-    return 0;
-}
 class File {
     rope data;
     size_t cursor;
     size_t col=0,row=0;
     size_t savepos=0;
+    size_t anchor=0;
     size_t size;
     Window* window;
+    LineIndex lines;
+    History history;
+    std::vector<LineEdit> edits;
+    std::vector<size_t> editLens;
+    bool dirty=true;
+#ifndef FATE_HEADLESS
+    // The last text copied, and how many copies there have been; the
+    // window's thread puts them on the clipboard, which SDL only lets it
+    // touch, a little later.
+    std::string copied;
+    size_t copies=0;
+#endif
+    friend struct FileBench;
     size_t count_total_lines() const {
-        size_t lines = 0;
-        for (size_t i=0;i<data.size();i++) {
-            if (data[i] == '\n') lines++;
-        }
-        return lines;
+        return lines.lines()-1;
+    }
+    // Length of a line without its '\n'.
+    size_t line_length(size_t line) const {
+        size_t len = lines.length(line);
+        return (line + 1 < lines.lines()) ? len - 1 : len;
     }
     size_t prev_newline(size_t pos) const {
         if (pos==0) return (size_t)-1;
-        for (size_t i=pos-1;i!=(size_t)-1;i--) {
-            if (data[i] == '\n') return i;
-            if (i == 0) break;
-        }
-        return (size_t)-1;
+        size_t line_start = lines.start(lines.lineOf(pos));
+        return (line_start == 0) ? (size_t)-1 : line_start - 1;
     }
     size_t next_newline(size_t pos) const {
-        for (size_t i = pos; i < data.size(); ++i) {
-            if (data[i] == '\n') return i;
-        }
-        return data.size();
+        if (pos >= size) return size;
+        size_t line = lines.lineOf(pos);
+        if (line + 1 >= lines.lines()) return size;
+        return lines.start(line) + lines.length(line) - 1;
     }
     size_t get_line_start(size_t pos) const {
         size_t line_start = prev_newline(pos);
@@ -60,17 +79,59 @@ class File {
         col = cursor - line_start;
     }
     void update_row_col() {
-        row = 0;
-        for (size_t i = 0; i < cursor && i < data.size(); ++i) {
-            if (data[i] == '\n') row++;
-        }
+        row = lines.lineOf(cursor);
         update_column();
     }
+    // Lines first..last, covering [begin, end), now hold new text measured
+    // as lens.
+    void reindex(size_t first, size_t last, size_t begin, size_t end, std::vector<size_t> lens) {
+        lens.front() += begin - lines.start(first);
+        lens.back() += lines.start(last) + lines.length(last) - end;
+        lines.replace(first, last - first + 1, lens);
+        edits.push_back({first, last - first + 1, lens.size()});
+        editLens.insert(editLens.end(), lens.begin(), lens.end());
+    }
+    // Switches to a snapshot that differs from the buffer only in
+    // [begin, size - tail), reindexing just that range.
+    void restore(const Snapshot& s, size_t begin, size_t tail) {
+        size_t end = size - tail;
+        std::vector<size_t> lens(1, 0);
+        for_each_chunk(s.text, begin, s.text.size() - tail, [&](const char* p, size_t n) {
+            size_t from = 0;
+            scan::for_each_newline(p, n, [&](size_t nl) {
+                lens.back() += nl + 1 - from;
+                lens.push_back(0);
+                from = nl + 1;
+            });
+            lens.back() += n - from;
+            return true;
+        });
+        reindex(lines.lineOf(begin), lines.lineOf(end), begin, end, lens);
+        data = s.text;
+        size = data.size();
+        cursor = s.cursor;
+        anchor = s.anchor;
+        update_row_col();
+        savepos = col;
+        dirty = true;
+    }
 public:
     std::pair<int,int> mousePos() {
         return {col,row};
     }
-    File(const std::string& filename,Window* w) : cursor(0),window(w),col(0),row(0),savepos(0) {
+    File(const std::string& filename,Window* w) : cursor(0),col(0),row(0),savepos(0),window(w) {
+        if (MappedFile* mapped = MappedFile::open(filename)) {
+            size = mapped->size();
+            mapped->advise(MADV_SEQUENTIAL);
+            bool whole = lines.assignPieces([&](auto&& piece) { return mapped->forEachBlock(piece); });
+            mapped->advise(MADV_NORMAL);
+            if (whole) {
+                data = rope(mapped, size, true);
+                return;
+            }
+            // Truncated while loading; read what is there now instead.
+            delete mapped;
+        }
         std::ifstream file(filename);
         if (!file) {
             data = rope("");
@@ -79,29 +140,75 @@ public:
         }
         std::stringstream buffer;
         buffer << file.rdbuf();
-        data = rope(buffer.str().c_str());
+        std::string text = buffer.str();
+        data = rope(text.data(), text.size());
         size = data.size();
+        lines.assign(text.data(), size);
     }
     rope& getrope() {
         return data;
     }
-    void move(Direction d) {
+    // Set by edits and cursor moves until the view has picked them up.
+    bool isDirty() const {
+        return dirty;
+    }
+    void clean() {
+        dirty = false;
+    }
+    // Fills s with the text, the cursor and the line edits since the last
+    // call, oldest first. The journal is swapped with the snapshot's
+    // vectors, whose old contents are dropped but whose capacity is kept.
+    void snapshot(BufferSnapshot& s) {
+        s.text = data;
+        s.cursor = cursor;
+        s.anchor = anchor;
+        s.edits.swap(edits);
+        s.lens.swap(editLens);
+        edits.clear();
+        editLens.clear();
+    }
+    const LineIndex& lineIndex() const {
+        return lines;
+    }
+    size_t lineCount() const {
+        return lines.lines();
+    }
+    size_t lineStart(size_t line) const {
+        return lines.start(line);
+    }
+    size_t lineLength(size_t line) const {
+        return line_length(line);
+    }
+    // Text of a line without its '\n'.
+    void lineText(size_t line, std::string& out) const {
+        size_t start = lines.start(line);
+        out.clear();
+        append_range(data, start, start + line_length(line), out);
+    }
+    // (col,row) of an offset, in the same form as mousePos.
+    std::pair<size_t,size_t> position(size_t offset) const {
+        size_t line = lines.lineOf(offset);
+        return {offset - lines.start(line), line};
+    }
+    // With extend set the anchor stays put and the selection grows.
+    void move(Direction d, bool extend = false) {
+        dirty = true;
         switch(d) {
             case LEFT:
                 if (cursor > 0) {
                     cursor--;
-                    if (cursor < data.size() && data[cursor] == '\n') {
+                    if (col == 0) {
                         if (row > 0) row--;
-                        update_column();
+                        col = line_length(row);
                     } else {
-                        col = (col > 0) ? col - 1 : 0;
+                        col--;
                     }
                 }
                 savepos = col;
                 break;
             case RIGHT:
                 if (cursor < size) {
-                    if (cursor < data.size() && data[cursor] == '\n') {
+                    if (col == line_length(row)) {
                         row++;
                         col = 0;
                     } else {
@@ -114,15 +221,10 @@ public:
             case UP: {
                 if (row > 0) {
                     row--;
-                    size_t current_line_start = get_line_start(cursor);
-                    if (current_line_start > 0) {
-                        size_t prev_line_end = current_line_start - 1;
-                        size_t prev_line_start = get_line_start(prev_line_end);
-                        size_t prev_line_len = prev_line_end - prev_line_start;
-                        size_t target_col = (savepos <= prev_line_len) ? savepos : prev_line_len;
-                        cursor = prev_line_start + target_col;
-                        col = target_col;
-                    }
+                    size_t prev_line_len = line_length(row);
+                    size_t target_col = (savepos <= prev_line_len) ? savepos : prev_line_len;
+                    cursor = lines.start(row) + target_col;
+                    col = target_col;
                 }
                 break;
             }
@@ -130,18 +232,10 @@ public:
                 size_t total_lines = count_total_lines();
                 if (row < total_lines) {
                     row++;
-                    size_t current_line_end = get_line_end(cursor);
-                    if (current_line_end < size) {
-                        size_t next_line_start = current_line_end + 1;
-                        size_t next_line_end = get_line_end(next_line_start);
-                        size_t next_line_len = next_line_end - next_line_start;
-                        size_t target_col = (savepos <= next_line_len) ? savepos : next_line_len;
-                        cursor = next_line_start + target_col;
-                        col = target_col;
-                    } else {
-                        cursor = size;
-                        update_column();
-                    }
+                    size_t next_line_len = line_length(row);
+                    size_t target_col = (savepos <= next_line_len) ? savepos : next_line_len;
+                    cursor = lines.start(row) + target_col;
+                    col = target_col;
                 } else {
                     cursor = size;
                     update_column();
@@ -153,115 +247,150 @@ public:
             cursor = size;
             update_row_col();
         }
+        if (!extend) anchor = cursor;
+        history.close();
     }
-    void insert(char c) {
-        if (cursor > size) cursor = size;
-        data.insert(cursor, &c, 1);
-        cursor++;
-        size++;
-        if (c == '\n') {
-            col = 0;
-            row++;
-            savepos = 0;
+    // Replaces [begin, end) with text as one rope edit and one line index
+    // update, leaving the cursor after the new text.
+    void replace(size_t begin, size_t end, std::string_view text) {
+        TRACE_SCOPE("File::replace");
+        if (end > size) end = size;
+        if (begin > end) begin = end;
+        EditGroup::Kind kind = EditGroup::OTHER;
+        if (begin == end && !text.empty() && text.find('\n') == std::string_view::npos) kind = EditGroup::TYPING;
+        if (end == begin + 1 && text.empty()) kind = EditGroup::DELETING;
+        history.record({data, cursor, anchor}, begin, end, text.size(), kind);
+        dirty = true;
+        size_t first = lines.lineOf(begin);
+        size_t last = lines.lineOf(end);
+        if (first == last && text.find('\n') == std::string_view::npos) {
+            lines.resize(first, (long)text.size() - (long)(end - begin));
+            edits.push_back({first, 1, 1});
+            editLens.push_back(lines.length(first));
         } else {
-            col++;
-            savepos = col;
+            reindex(first, last, begin, end, LineIndex::measure(text.data(), text.size()));
         }
+        size_t allocated = profiler::allocatedBytes;
+        data.replace(begin, end - begin, text.data(), text.size());
+        history.charge(profiler::allocatedBytes - allocated);
+        size = size - (end - begin) + text.size();
+        cursor = anchor = begin + text.size();
+        update_row_col();
+        savepos = col;
+    }
+    void undo() {
+        TRACE_SCOPE("File::undo");
+        if (const EditGroup* g = history.undo({data, cursor, anchor})) restore(g->before, g->begin, g->tail);
+    }
+    void redo() {
+        TRACE_SCOPE("File::redo");
+        if (const EditGroup* g = history.redo()) restore(g->after, g->begin, g->tail);
+    }
+    void setUndoBudget(size_t bytes) {
+        history.setBudget(bytes);
+    }
+    void insert(std::string_view text) {
+        auto sel = selection();
+        replace(sel.first, sel.second, text);
+    }
+    void insert(char c) {
+        insert(std::string_view(&c, 1));
+    }
+    void erase(size_t begin, size_t end) {
+        replace(begin, end, std::string_view());
     }
     void remove() {
-        if (cursor == 0 || size == 0) return;
-        char removed = data[cursor - 1];
-        data.erase(cursor - 1, 1);
-        cursor--;
-        size--;
-        if (removed == '\n') {
-            if (row > 0) row--;
-            update_column();
-            savepos = col;
-        } else {
-            col = (col > 0) ? col - 1 : 0;
-            savepos = col;
+        auto sel = selection();
+        if (sel.first != sel.second) {
+            erase(sel.first, sel.second);
+        } else if (cursor > 0) {
+            erase(cursor - 1, cursor);
         }
-        if (cursor > size) {
-            cursor = size;
-            update_row_col();
-            savepos = col;
+    }
+    // Selected range, empty when the anchor sits on the cursor.
+    std::pair<size_t,size_t> selection() const {
+        return {std::min(anchor, cursor), std::max(anchor, cursor)};
+    }
+    std::string text(size_t begin, size_t end) const {
+        std::string out;
+        append_range(data, begin, end, out);
+        return out;
+    }
+    void selectAll() {
+        dirty = true;
+        anchor = 0;
+        cursor = size;
+        update_row_col();
+        savepos = col;
+    }
+#ifndef FATE_HEADLESS
+    void copy() {
+        auto sel = selection();
+        if (sel.first == sel.second) return;
+        copied = text(sel.first, sel.second);
+        copies++;
+    }
+    void cut() {
+        copy();
+        auto sel = selection();
+        if (sel.first != sel.second) erase(sel.first, sel.second);
+    }
+    // A copy the clipboard the batch read doesn't have yet wins over it.
+    void paste(const InputBatch& in) {
+        if (in.copies < copies) insert(copied);
+        else if (in.hasClipboard) insert(in.clipboard);
+    }
+    static bool arrow(SDL_Scancode sc, Direction& d) {
+        switch (sc) {
+            case SDL_SCANCODE_LEFT: d = LEFT; return true;
+            case SDL_SCANCODE_RIGHT: d = RIGHT; return true;
+            case SDL_SCANCODE_UP: d = UP; return true;
+            case SDL_SCANCODE_DOWN: d = DOWN; return true;
+            default: return false;
         }
     }
-    void updateFromWindow() {
-        bool shift_pressed = window->keyspressed[SDLK_LSHIFT] || window->keyspressed[SDLK_RSHIFT];
-        bool caps_lock_on = (SDL_GetModState() & KMOD_CAPS) != 0;
-        int min_frame = INT_MAX;
-        char inserted_char = 0;
-        bool key_pressed = false;
-        for (SDL_Keycode key = SDLK_SPACE; key <= SDLK_z; ++key) {
-            int frame_count = window->keyspressed[key];
-            if (frame_count == 0 || frame_count >= min_frame) continue;
-            min_frame = frame_count;
-            key_pressed = true;
-            if (key >= SDLK_a && key <= SDLK_z) {
-                inserted_char = 'a' + (key - SDLK_a);
-                if ((shift_pressed && !caps_lock_on) || (!shift_pressed && caps_lock_on)) {
-                    inserted_char = inserted_char - 'a' + 'A';
-                }
+    // Applies every queued keystroke in order; runs of typed text become a
+    // single insert. Arrow presses move where they fall among the rest;
+    // holding one then repeats on the Keyboard's clock, so the OS's own
+    // repeats are skipped.
+    void update(const InputBatch& in) {
+        for (const InputEvent& e : in.input) {
+            if (e.type == InputEvent::TEXT) {
+                insert(in.text(e));
+                continue;
             }
-            else if (key >= SDLK_0 && key <= SDLK_9) {
-                if (shift_pressed) {
-                    const char shift_nums[] = ")!@#$%^&*(";
-                    inserted_char = shift_nums[key - SDLK_0];
-                } else {
-                    inserted_char = '0' + (key - SDLK_0);
-                }
+            bool shift_pressed = e.key.mod & KMOD_SHIFT;
+            Direction d;
+            if (arrow(e.key.scancode, d)) {
+                if (!e.repeat) move(d, shift_pressed);
+                continue;
             }
-            else {
-                switch(key) {
-                    case SDLK_SPACE: inserted_char = ' '; break;
-                    case SDLK_PERIOD: inserted_char = shift_pressed ? '>' : '.'; break;
-                    case SDLK_COMMA: inserted_char = shift_pressed ? '<' : ','; break;
-                    case SDLK_SEMICOLON: inserted_char = shift_pressed ? ':' : ';'; break;
-                    case SDLK_QUOTE: inserted_char = shift_pressed ? '"' : '\''; break;
-                    case SDLK_LEFTBRACKET: inserted_char = shift_pressed ? '{' : '['; break;
-                    case SDLK_RIGHTBRACKET: inserted_char = shift_pressed ? '}' : ']'; break;
-                    case SDLK_BACKSLASH: inserted_char = shift_pressed ? '|' : '\\'; break;
-                    case SDLK_SLASH: inserted_char = shift_pressed ? '?' : '/'; break;
-                    case SDLK_EQUALS: inserted_char = shift_pressed ? '+' : '='; break;
-                    case SDLK_MINUS: inserted_char = shift_pressed ? '_' : '-'; break;
-                    case SDLK_BACKQUOTE: inserted_char = shift_pressed ? '~' : '`'; break;
-                    default: inserted_char = 0;
+            if (e.key.mod & KMOD_CTRL) {
+                switch (e.key.sym) {
+                    case SDLK_a: selectAll(); break;
+                    case SDLK_c: copy(); break;
+                    case SDLK_x: cut(); break;
+                    case SDLK_v: paste(in); break;
+                    case SDLK_z: shift_pressed ? redo() : undo(); break;
+                    case SDLK_y: redo(); break;
                 }
+                continue;
             }
-        }
-        if (Pressed(window->keyspressed[SDLK_LEFT])) move(LEFT);
-        if (Pressed(window->keyspressed[SDLK_RIGHT])) move(RIGHT);
-        if (Pressed(window->keyspressed[SDLK_UP])) move(UP);
-        if (Pressed(window->keyspressed[SDLK_DOWN])) move(DOWN);
-        if (window->keyspressed[SDLK_TAB]&&window->keyspressed[SDLK_TAB]<min_frame) {
-            min_frame = window->keyspressed[SDLK_TAB];
-            key_pressed = true;
-            inserted_char = '\t';
-        }
-        if (window->keyspressed[SDLK_RETURN]&&window->keyspressed[SDLK_RETURN]<min_frame) {
-            min_frame = window->keyspressed[SDLK_RETURN];
-            key_pressed = true;
-            inserted_char = '\n';
-        }
-        if (window->keyspressed[SDLK_BACKSPACE]&&window->keyspressed[SDLK_BACKSPACE]<min_frame) {
-            min_frame = window->keyspressed[SDLK_BACKSPACE];
-            key_pressed = true;
-            inserted_char = '\b';
-        }
-        if (key_pressed && Pressed(min_frame)) {
-            if (inserted_char == '\t') {
-                insert(' ');
-                insert(' ');
-                insert(' ');
-                insert(' ');
-            } else if (inserted_char == '\b') {
-                remove();
-            } else if (inserted_char != 0) {
-                insert(inserted_char);
+            switch (e.key.sym) {
+                case SDLK_RETURN: insert('\n'); break;
+                case SDLK_TAB: insert("    "); break;
+                case SDLK_BACKSPACE: remove(); break;
             }
         }
+        for (Direction d : {LEFT, RIGHT, UP, DOWN}) {
+            for (int i = in.repeats[d]; i > 0; i--) move(d, in.shift);
+        }
+    }
+    // The last copy and its number; nothing new if that is copiesSeen.
+    size_t lastCopy(size_t copiesSeen, std::string& out) const {
+        if (copies != copiesSeen) out = copied;
+        return copies;
     }
+#endif
 };
 #endif
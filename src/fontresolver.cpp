@@ -0,0 +1,120 @@
+#ifndef FONT_RESOLVER
+#define FONT_RESOLVER
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fontconfig/fontconfig.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// Family/style to font file lookups. fontconfig is initialized at most once,
+// on the first lookup that misses, and results are kept both in memory and
+// in $XDG_CACHE_HOME/fate/fonts.cache. The on-disk cache is tagged with the
+// newest mtime among fontconfig's config and cache directories, which
+// fc-cache and font installs bump, so warm starts skip fontconfig entirely.
+class FontResolver {
+    bool initialized=false;
+    std::unordered_map<std::string,std::string> paths;
+    std::string cacheFile;
+    std::string header;
+    static std::string home(const char* xdg,const char* fallback) {
+        const char* dir=getenv(xdg);
+        if (dir&&*dir) return dir;
+        const char* h=getenv("HOME");
+        return std::string(h?h:".")+"/"+fallback;
+    }
+    static long long mtime(const std::string& path) {
+        struct stat st;
+        if (stat(path.c_str(),&st)!=0) return 0;
+        return (long long)st.st_mtim.tv_sec*1000000000LL+st.st_mtim.tv_nsec;
+    }
+    static std::string stamp() {
+        std::string config=home("XDG_CONFIG_HOME",".config");
+        std::string cache=home("XDG_CACHE_HOME",".cache");
+        const std::string watched[]={
+            "/etc/fonts/fonts.conf","/etc/fonts/conf.d","/etc/fonts/local.conf",
+            config+"/fontconfig",config+"/fontconfig/fonts.conf",
+            "/var/cache/fontconfig",cache+"/fontconfig",
+        };
+        long long newest=0;
+        for (const auto& p:watched) newest=std::max(newest,mtime(p));
+        return "fate-fonts "+std::to_string(FC_VERSION)+" "+std::to_string(newest);
+    }
+    static bool exists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(),&st)==0;
+    }
+    void load() {
+        std::ifstream in(cacheFile);
+        std::string line;
+        if (!std::getline(in,line)||line!=header) return;
+        while (std::getline(in,line)) {
+            size_t tab=line.find('\t',line.find('\t')+1);
+            if (tab==std::string::npos) continue;
+            paths[line.substr(0,tab)]=line.substr(tab+1);
+        }
+    }
+    // Written to a temporary and renamed, so concurrent launches never see
+    // a half-written cache.
+    void save() {
+        std::string dir=cacheFile.substr(0,cacheFile.rfind('/'));
+        mkdir(dir.substr(0,dir.rfind('/')).c_str(),0755);
+        mkdir(dir.c_str(),0755);
+        std::string tmp=cacheFile+"."+std::to_string(getpid());
+        {
+            std::ofstream out(tmp);
+            if (!out) return;
+            out<<header<<"\n";
+            for (const auto& p:paths) out<<p.first<<"\t"<<p.second<<"\n";
+        }
+        std::rename(tmp.c_str(),cacheFile.c_str());
+    }
+    std::string match(const std::string& family,const std::string& style) {
+        if (!initialized) initialized=FcInit();
+        FcPattern* pat=FcPatternCreate();
+        FcPatternAddString(pat,FC_FAMILY,(FcChar8*)family.c_str());
+        if (!style.empty()) FcPatternAddString(pat,FC_STYLE,(FcChar8*)style.c_str());
+        FcConfigSubstitute(NULL,pat,FcMatchPattern);
+        FcDefaultSubstitute(pat);
+        FcResult result;
+        FcPattern* font=FcFontMatch(NULL,pat,&result);
+        std::string path;
+        if (font) {
+            FcChar8* file=nullptr;
+            if (FcPatternGetString(font,FC_FILE,0,&file)==FcResultMatch) {
+                path=(char*)file;
+            }
+            FcPatternDestroy(font);
+        }
+        FcPatternDestroy(pat);
+        return path;
+    }
+    FontResolver(): cacheFile(home("XDG_CACHE_HOME",".cache")+"/fate/fonts.cache"),header(stamp()) {
+        load();
+    }
+public:
+    FontResolver(const FontResolver&)=delete;
+    FontResolver& operator=(const FontResolver&)=delete;
+    ~FontResolver() {
+        if (initialized) FcFini();
+    }
+    static FontResolver& instance() {
+        static FontResolver resolver;
+        return resolver;
+    }
+    std::string resolve(const std::string& family,const std::string& style="") {
+        std::string key=family+"\t"+style;
+        auto it=paths.find(key);
+        if (it!=paths.end()&&exists(it->second)) return it->second;
+        std::string path=match(family,style);
+        if (!path.empty()) {
+            paths[key]=path;
+            save();
+        }
+        return path;
+    }
+};
+#endif
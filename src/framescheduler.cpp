@@ -0,0 +1,123 @@
+#ifndef FRAME_SCHEDULER
+#define FRAME_SCHEDULER
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Paces the frames of a thread that prepares them against the display. Present times and frame
+// costs are measured on the steady clock; with vsync the scheduler keeps
+// an estimate of the refresh period and its phase (a blocking present
+// returns at a vblank), and starts each frame, input sampling included, as
+// late as it can while still making the next vblank. Unlocked, frames
+// start as soon as there is something to draw and present without
+// waiting. Either way, every keystroke's arrival-to-present time can be
+// logged, and each frame's timings reported as a line of JSON with a
+// summary line of percentiles at the end.
+class FrameScheduler {
+public:
+    using clock = std::chrono::steady_clock;
+    struct Options {
+        bool unlocked=false;
+        bool logLatency=false;
+        FILE* report=nullptr;
+    };
+private:
+    // Kept between the end of submitting a frame and the vblank it aims
+    // for, to absorb scheduling and driver jitter.
+    static constexpr clock::duration SLACK=std::chrono::microseconds(1500);
+    // Presents further apart than this say nothing about the vblank phase.
+    static constexpr clock::duration STALE=std::chrono::seconds(1);
+    Options options;
+    clock::duration period;
+    clock::duration cost{0};
+    clock::time_point lastPresent,frameStart;
+    bool phased=false;
+    std::vector<clock::time_point> keystrokes;
+    // For the report.
+    clock::time_point firstStart,submitTime;
+    size_t frames=0;
+    std::vector<double> frameTimes,latencies;
+    static double ms(clock::duration d) {
+        return std::chrono::duration<double,std::milli>(d).count();
+    }
+    void summarize(const char* name,std::vector<double>& samples) {
+        std::sort(samples.begin(),samples.end());
+        auto at=[&](size_t pct) { return samples.empty()?0.0:samples[(samples.size()-1)*pct/100]; };
+        fprintf(options.report,"\"%s\":{\"count\":%zu,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+            name,samples.size(),at(50),at(95),at(99),samples.empty()?0.0:samples.back());
+    }
+public:
+    FrameScheduler(int refreshRate,Options o): options(o),
+        period(std::chrono::nanoseconds(1000000000/(refreshRate>0?refreshRate:60))) {}
+    FrameScheduler(const FrameScheduler&)=delete;
+    FrameScheduler& operator=(const FrameScheduler&)=delete;
+    ~FrameScheduler() {
+        if (!options.report) return;
+        fprintf(options.report,"{\"frames\":%zu,",frames);
+        summarize("frame_ms",frameTimes);
+        fprintf(options.report,",");
+        summarize("latency_ms",latencies);
+        fprintf(options.report,"}\n");
+        fflush(options.report);
+    }
+    bool unlocked() const {
+        return options.unlocked;
+    }
+    // The latest time to start the next frame and still present it on the
+    // first vblank that leaves room for it.
+    clock::time_point nextStart() const {
+        clock::time_point now=clock::now();
+        if (options.unlocked||!phased||now-lastPresent>STALE) return now;
+        clock::duration lead=cost+SLACK;
+        clock::time_point vblank=lastPresent+period;
+        if (vblank-lead<now) vblank+=((now+lead-vblank)/period+1)*period;
+        return vblank-lead;
+    }
+    void waitForStart() {
+        std::this_thread::sleep_until(nextStart());
+    }
+    // Input taken in from here on belongs to the frame.
+    void begin() {
+        frameStart=clock::now();
+        if (!frames) firstStart=frameStart;
+    }
+    // A keystroke that arrived at t and is shown by the next present.
+    void keystroke(clock::time_point t) {
+        keystrokes.push_back(t);
+    }
+    // Drawing was submitted at the given time; only the present was left.
+    // Rises at once to a slower frame and falls back slowly, so one fast
+    // frame doesn't make the next one late.
+    void submitted(clock::time_point at=clock::now()) {
+        submitTime=at;
+        clock::duration c=submitTime-frameStart;
+        cost=c>cost?c:cost+(c-cost)/16;
+    }
+    // The present returned at the given time.
+    void presented(clock::time_point now=clock::now()) {
+        clock::duration delta=now-lastPresent;
+        if (phased&&delta>period/2&&delta<period*3/2) period+=(delta-period)/8;
+        lastPresent=now;
+        phased=!options.unlocked;
+        if (options.logLatency) {
+            for (clock::time_point t:keystrokes) {
+                fprintf(stderr,"keystroke latency %.2f ms\n",ms(now-t));
+            }
+        }
+        if (options.report) {
+            frameTimes.push_back(ms(now-frameStart));
+            fprintf(options.report,"{\"frame\":%zu,\"start_ms\":%.3f,\"work_ms\":%.3f,\"present_ms\":%.3f,\"latency_ms\":[",
+                frames,ms(frameStart-firstStart),ms(submitTime-frameStart),ms(now-submitTime));
+            for (size_t i=0;i<keystrokes.size();i++) {
+                latencies.push_back(ms(now-keystrokes[i]));
+                fprintf(options.report,"%s%.3f",i?",":"",latencies.back());
+            }
+            fprintf(options.report,"]}\n");
+        }
+        frames++;
+        keystrokes.clear();
+    }
+};
+#endif
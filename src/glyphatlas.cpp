@@ -0,0 +1,207 @@
+#ifndef GLYPH_ATLAS
+#define GLYPH_ATLAS
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_pixels.h>
+#include <SDL2/SDL_rect.h>
+#include <SDL2/SDL_render.h>
+#include <SDL2/SDL_ttf.h>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "trace.cpp"
+
+struct Glyph {
+    int page=-1;
+    SDL_Rect src={0,0,0,0};
+    int advance=0;
+};
+
+// Glyphs of one font (and therefore one size) rasterized once into shelf
+// packed pages. Text is queued as textured quads and submitted with one
+// SDL_RenderGeometry call per page. Only submit and the destructor touch
+// the renderer; the rest may run on another thread while it is idle.
+class GlyphAtlas {
+    static const int PAGE_SIZE=1024;
+    struct Page {
+        SDL_Surface* surface=nullptr;
+        SDL_Texture* texture=nullptr;
+        int shelfX=0,shelfY=0,shelfHeight=0;
+        SDL_Rect dirty={0,0,0,0};
+        std::vector<SDL_Vertex> vertices;
+        std::vector<int> indices;
+        size_t submitted=0;
+    };
+    SDL_Renderer* renderer;
+    TTF_Font* font;
+    std::vector<Page> pages;
+    std::unordered_map<Uint32,Glyph> glyphs;
+    size_t hitCount=0,missCount=0;
+    bool newPage() {
+        Page p;
+        p.surface=SDL_CreateRGBSurfaceWithFormat(0,PAGE_SIZE,PAGE_SIZE,32,SDL_PIXELFORMAT_ARGB8888);
+        if (!p.surface) {
+            std::cerr<<"SDL_CreateRGBSurfaceWithFormat Error: "<<SDL_GetError()<<std::endl;
+            return false;
+        }
+        SDL_FillRect(p.surface,NULL,0);
+        pages.push_back(p);
+        return true;
+    }
+    // A page's texture is made on its first submit, on the renderer's
+    // thread; until then its glyphs only exist in the surface.
+    static bool upload(SDL_Renderer* renderer,Page& p) {
+        if (!p.texture) {
+            TRACE_SCOPE("SDL_CreateTexture");
+            p.texture=SDL_CreateTexture(renderer,SDL_PIXELFORMAT_ARGB8888,SDL_TEXTUREACCESS_STATIC,PAGE_SIZE,PAGE_SIZE);
+            if (!p.texture) {
+                std::cerr<<"SDL_CreateTexture Error: "<<SDL_GetError()<<std::endl;
+                return false;
+            }
+            SDL_SetTextureBlendMode(p.texture,SDL_BLENDMODE_BLEND);
+        }
+        if (p.dirty.w>0&&p.dirty.h>0) {
+            const Uint8* pixels=(const Uint8*)p.surface->pixels+p.dirty.y*p.surface->pitch+p.dirty.x*4;
+            SDL_UpdateTexture(p.texture,&p.dirty,pixels,p.surface->pitch);
+            p.dirty={0,0,0,0};
+        }
+        return true;
+    }
+    static void growDirty(SDL_Rect& d,const SDL_Rect& r) {
+        if (d.w==0||d.h==0) {
+            d=r;
+            return;
+        }
+        int x2=std::max(d.x+d.w,r.x+r.w),y2=std::max(d.y+d.h,r.y+r.h);
+        d.x=std::min(d.x,r.x);
+        d.y=std::min(d.y,r.y);
+        d.w=x2-d.x;
+        d.h=y2-d.y;
+    }
+    Glyph rasterize(Uint16 ch) {
+        Glyph g;
+        int minx,maxx,miny,maxy;
+        if (TTF_GlyphMetrics(font,ch,&minx,&maxx,&miny,&maxy,&g.advance)!=0) g.advance=0;
+        SDL_Surface* surface=TTF_RenderGlyph_Blended(font,ch,{255,255,255,255});
+        if (!surface) return g;
+        if (surface->w>PAGE_SIZE||surface->h>PAGE_SIZE) {
+            SDL_FreeSurface(surface);
+            return g;
+        }
+        if (pages.empty()&&!newPage()) {
+            SDL_FreeSurface(surface);
+            return g;
+        }
+        Page* p=&pages.back();
+        if (p->shelfX+surface->w>PAGE_SIZE) {
+            p->shelfX=0;
+            p->shelfY+=p->shelfHeight+1;
+            p->shelfHeight=0;
+        }
+        if (p->shelfY+surface->h>PAGE_SIZE) {
+            if (!newPage()) {
+                SDL_FreeSurface(surface);
+                return g;
+            }
+            p=&pages.back();
+        }
+        g.page=pages.size()-1;
+        g.src={p->shelfX,p->shelfY,surface->w,surface->h};
+        SDL_SetSurfaceBlendMode(surface,SDL_BLENDMODE_NONE);
+        SDL_Rect dst=g.src;
+        SDL_BlitSurface(surface,NULL,p->surface,&dst);
+        SDL_FreeSurface(surface);
+        growDirty(p->dirty,g.src);
+        p->shelfX+=g.src.w+1;
+        p->shelfHeight=std::max(p->shelfHeight,g.src.h);
+        return g;
+    }
+public:
+    GlyphAtlas(SDL_Renderer* r,TTF_Font* f): renderer(r),font(f) {}
+    GlyphAtlas(const GlyphAtlas&)=delete;
+    GlyphAtlas& operator=(const GlyphAtlas&)=delete;
+    ~GlyphAtlas() {
+        for (auto& p:pages) {
+            if (p.texture) SDL_DestroyTexture(p.texture);
+            if (p.surface) SDL_FreeSurface(p.surface);
+        }
+    }
+    const Glyph& get(Uint16 ch) {
+        Uint32 key=((Uint32)TTF_GetFontStyle(font)<<16)|ch;
+        auto it=glyphs.find(key);
+        if (it!=glyphs.end()) {
+            hitCount++;
+            return it->second;
+        }
+        missCount++;
+        return glyphs.emplace(key,rasterize(ch)).first->second;
+    }
+    // Lookups that found the glyph already rasterized, and ones that didn't.
+    size_t hits() const {
+        return hitCount;
+    }
+    size_t misses() const {
+        return missCount;
+    }
+    int advance(char c) {
+        return get((unsigned char)c).advance;
+    }
+    // Bytes are treated as Latin-1, the same as TTF_RenderText.
+    void queue(const char* text,size_t len,int x,int y,SDL_Color color) {
+        float penX=x;
+        for (size_t i=0;i<len;i++) {
+            const Glyph& g=get((unsigned char)text[i]);
+            if (g.page>=0&&g.src.w>0) {
+                Page& p=pages[g.page];
+                int base=p.vertices.size();
+                float x0=penX,y0=y,x1=penX+g.src.w,y1=y+g.src.h;
+                float u0=(float)g.src.x/PAGE_SIZE,v0=(float)g.src.y/PAGE_SIZE;
+                float u1=(float)(g.src.x+g.src.w)/PAGE_SIZE,v1=(float)(g.src.y+g.src.h)/PAGE_SIZE;
+                p.vertices.push_back({{x0,y0},color,{u0,v0}});
+                p.vertices.push_back({{x1,y0},color,{u1,v0}});
+                p.vertices.push_back({{x1,y1},color,{u1,v1}});
+                p.vertices.push_back({{x0,y1},color,{u0,v1}});
+                p.indices.insert(p.indices.end(),{base,base+1,base+2,base,base+2,base+3});
+            }
+            penX+=g.advance;
+        }
+    }
+    void queue(const std::string& text,int x,int y,SDL_Color color) {
+        queue(text.data(),text.size(),x,y,color);
+    }
+    // Queued index count of every page, to hand back to submit later.
+    void mark(std::vector<size_t>& out) const {
+        for (const auto& p:pages) out.push_back(p.indices.size());
+    }
+    // Uploads newly rasterized glyphs and submits the quads queued before
+    // marks (n pages, from mark) that have not been submitted yet, so text
+    // recorded between other draws keeps its place in the frame.
+    void submit(const size_t* marks,size_t n) {
+        for (size_t i=0;i<pages.size();i++) {
+            Page& p=pages[i];
+            size_t end=i<n?marks[i]:0;
+            if (!upload(renderer,p)||end<=p.submitted) continue;
+            SDL_RenderGeometry(renderer,p.texture,p.vertices.data(),p.vertices.size(),p.indices.data()+p.submitted,end-p.submitted);
+            p.submitted=end;
+        }
+    }
+    // Drops queued quads without drawing them.
+    void discard() {
+        for (auto& p:pages) {
+            p.vertices.clear();
+            p.indices.clear();
+            p.submitted=0;
+        }
+    }
+    // Submits everything still queued to the current render target.
+    void flush() {
+        std::vector<size_t> marks;
+        mark(marks);
+        submit(marks.data(),marks.size());
+        discard();
+    }
+};
+#endif
@@ -0,0 +1,142 @@
+#ifndef HISTORY
+#define HISTORY
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <ext/rope>
+typedef __gnu_cxx::crope rope;
+
+struct Snapshot {
+    rope text;
+    size_t cursor=0,anchor=0;
+};
+
+// One undo step. The buffer before and after the group differ only in
+// [begin, size - tail), the same range in both when tail is counted from
+// the end, so restoring a snapshot only has to reindex that range.
+struct EditGroup {
+    enum Kind { TYPING, DELETING, OTHER };
+    Snapshot before,after;
+    size_t begin,tail;
+    Kind kind;
+    size_t caret;
+    std::chrono::steady_clock::time_point time;
+    // Heap the edit that opened the group allocated, and all it is charged.
+    size_t pinned=0;
+    size_t cost=0;
+};
+
+// Undo/redo as rope snapshots. Copying a crope only bumps a refcount, but
+// every edit path-copies concat nodes and leaves, and a snapshot keeps the
+// tree it had alive: a group is charged the bytes it changed plus the heap
+// the edit that opened it allocated (see charge), about what the next
+// group's snapshot pins. Edits joining a group replace trees no snapshot
+// holds, so they add only their bytes. The memory budget counts those
+// charges, and there are never more than MAX_GROUPS undo steps either.
+// Consecutive typing or deleting within COALESCE_MS of the last edit and
+// continuing where it left off joins the open group.
+class History {
+    static const int COALESCE_MS=1000;
+    static const size_t MAX_GROUPS=1<<16;
+    std::deque<EditGroup> undos,redos;
+    size_t budget;
+    size_t used=0;
+    bool open=false;
+    // The last record started a group.
+    bool started=false;
+    static size_t costOf(const EditGroup& g,size_t sizeAfter) {
+        size_t end=g.before.text.size()-g.tail;
+        return (end-g.begin)+(sizeAfter-g.tail-g.begin)+sizeof(EditGroup)+g.pinned;
+    }
+    void trim() {
+        while ((used>budget||undos.size()>MAX_GROUPS)&&undos.size()>1) {
+            used-=undos.front().cost;
+            undos.pop_front();
+        }
+    }
+public:
+    History(size_t budget=64<<20): budget(budget) {}
+    void setBudget(size_t bytes) {
+        budget=bytes;
+        trim();
+    }
+    // Ends the open group, so the next edit starts a new one.
+    void close() {
+        open=false;
+    }
+    // Called before replacing [begin, end) of current with len bytes.
+    void record(const Snapshot& current,size_t begin,size_t end,size_t len,EditGroup::Kind kind) {
+        auto now=std::chrono::steady_clock::now();
+        size_t size=current.text.size();
+        size_t tail=size-end;
+        size_t sizeAfter=size-(end-begin)+len;
+        for (auto& g:redos) used-=g.cost;
+        redos.clear();
+        started=false;
+        if (open&&!undos.empty()) {
+            EditGroup& g=undos.back();
+            auto idle=std::chrono::duration_cast<std::chrono::milliseconds>(now-g.time).count();
+            size_t anchor=(kind==EditGroup::DELETING)?end:begin;
+            if (kind!=EditGroup::OTHER&&g.kind==kind&&anchor==g.caret&&idle<COALESCE_MS) {
+                g.begin=std::min(g.begin,begin);
+                g.tail=std::min(g.tail,tail);
+                g.caret=begin+len;
+                g.time=now;
+                used-=g.cost;
+                g.cost=costOf(g,sizeAfter);
+                used+=g.cost;
+                trim();
+                return;
+            }
+        }
+        EditGroup g;
+        g.before=current;
+        g.begin=begin;
+        g.tail=tail;
+        g.kind=kind;
+        g.caret=begin+len;
+        g.time=now;
+        g.cost=costOf(g,sizeAfter);
+        used+=g.cost;
+        undos.push_back(g);
+        open=true;
+        started=true;
+        trim();
+    }
+    // Called after the edit record was told about, with the bytes it
+    // allocated in the rope.
+    void charge(size_t bytes) {
+        if (!started||undos.empty()) return;
+        EditGroup& g=undos.back();
+        g.pinned=bytes;
+        used+=bytes;
+        g.cost+=bytes;
+        trim();
+    }
+    bool canUndo() const {
+        return !undos.empty();
+    }
+    bool canRedo() const {
+        return !redos.empty();
+    }
+    // Moves the newest group to the redo stack and returns it; the caller
+    // restores group->before. Valid until the next History call.
+    const EditGroup* undo(const Snapshot& current) {
+        if (undos.empty()) return nullptr;
+        open=false;
+        redos.push_back(undos.back());
+        undos.pop_back();
+        redos.back().after=current;
+        return &redos.back();
+    }
+    // The caller restores group->after.
+    const EditGroup* redo() {
+        if (redos.empty()) return nullptr;
+        open=false;
+        undos.push_back(redos.back());
+        redos.pop_back();
+        return &undos.back();
+    }
+};
+#endif
@@ -0,0 +1,83 @@
+#ifndef KEYBOARD
+#define KEYBOARD
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_scancode.h>
+#include <SDL2/SDL_timer.h>
+#include <array>
+#include <bitset>
+
+// Key state indexed by scancode: which keys are held, which went down since
+// the last beginFrame, and time-based auto-repeat for keys whose repeats
+// are being consumed. Fixed arrays only, so updating it never allocates.
+// Times are in ms on whatever clock the window runs on, SDL_GetTicks
+// unless a session is replaying.
+class Keyboard {
+    Uint32 now=0;
+    std::array<Uint32,SDL_NUM_SCANCODES> downAt{};
+    std::array<Uint32,SDL_NUM_SCANCODES> nextRepeat{};
+    std::bitset<SDL_NUM_SCANCODES> held,pressedNow,repeating;
+public:
+    static const Uint32 REPEAT_DELAY=500;
+    static const Uint32 REPEAT_INTERVAL=33;
+    // time is when the frame's input is taken in.
+    void beginFrame(Uint32 time) {
+        now=time;
+        pressedNow.reset();
+    }
+    void keyDown(SDL_Scancode sc) {
+        if (sc>=SDL_NUM_SCANCODES||held[sc]) return;
+        held.set(sc);
+        pressedNow.set(sc);
+        downAt[sc]=now;
+        nextRepeat[sc]=now+REPEAT_DELAY;
+    }
+    void keyUp(SDL_Scancode sc) {
+        if (sc>=SDL_NUM_SCANCODES) return;
+        held.reset(sc);
+        repeating.reset(sc);
+    }
+    bool isHeld(SDL_Scancode sc) const {
+        return held[sc];
+    }
+    bool pressed(SDL_Scancode sc) const {
+        return pressedNow[sc];
+    }
+    bool heldFor(SDL_Scancode sc,Uint32 ms) const {
+        return held[sc]&&now-downAt[sc]>=ms;
+    }
+    // How many times a held key repeated since the last call: every
+    // REPEAT_INTERVAL ms after REPEAT_DELAY, regardless of frame rate. The
+    // press itself isn't counted; it comes in order with the other input.
+    int autoRepeats(SDL_Scancode sc) {
+        if (!held[sc]) return 0;
+        repeating.set(sc);
+        int n=0;
+        while (SDL_TICKS_PASSED(now,nextRepeat[sc])) {
+            n++;
+            nextRepeat[sc]+=REPEAT_INTERVAL;
+        }
+        return n;
+    }
+    bool any() const {
+        return held.any();
+    }
+    // Milliseconds from time until a held, repeating key fires again, -1
+    // if none.
+    int nextDeadline(Uint32 time) const {
+        if ((held&repeating).none()) return -1;
+        int best=-1;
+        for (int sc=0;sc<SDL_NUM_SCANCODES;sc++) {
+            if (!held[sc]||!repeating[sc]) continue;
+            int wait=SDL_TICKS_PASSED(time,nextRepeat[sc])?0:(int)(nextRepeat[sc]-time);
+            if (best<0||wait<best) best=wait;
+        }
+        return best;
+    }
+    bool shift() const {
+        return held[SDL_SCANCODE_LSHIFT]||held[SDL_SCANCODE_RSHIFT];
+    }
+    bool ctrl() const {
+        return held[SDL_SCANCODE_LCTRL]||held[SDL_SCANCODE_RCTRL];
+    }
+};
+#endif
@@ -0,0 +1,152 @@
+#ifndef LAYOUT
+#define LAYOUT
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "lineindex.cpp"
+
+// Font metrics policies. Layout and cursor placement are templated on
+// these, so a fixed-width font costs constant-time arithmetic per row and a
+// proportional one a table lookup per byte; neither calls into the font
+// library once built.
+struct Monospace {
+    int cell=0;
+    int advance(char) const {
+        return cell;
+    }
+    // x of col in a row starting at column begin.
+    int x(std::string_view,size_t begin,size_t col) const {
+        return (int)(col-begin)*cell;
+    }
+};
+
+struct Proportional {
+    std::array<int,256> advances{};
+    int advance(char c) const {
+        return advances[(unsigned char)c];
+    }
+    // Columns past the end of the text count as spaces.
+    int x(std::string_view text,size_t begin,size_t col) const {
+        int x=0;
+        for (size_t i=begin;i<col;i++) x+=advance(i<text.size()?text[i]:' ');
+        return x;
+    }
+};
+
+struct FontMetrics {
+    bool fixed=false;
+    int lineHeight=0;
+    Monospace mono;
+    Proportional prop;
+};
+
+// Calls f with whichever policy applies to the font.
+template<class F>
+void withMetrics(const FontMetrics& m,F&& f) {
+    if (m.fixed) {
+        f(m.mono);
+    } else {
+        f(m.prop);
+    }
+}
+
+// Greedy wrap of one logical line: fills breaks with the offsets at which
+// the second and later visual rows begin. Every row keeps at least one
+// character, however narrow maxWidth is.
+template<class Metrics>
+void wrapLine(const Metrics& m,const char* text,size_t len,int maxWidth,std::vector<size_t>& breaks) {
+    breaks.clear();
+    int width=0;
+    size_t rowStart=0;
+    for (size_t i=0;i<len;i++) {
+        int a=m.advance(text[i]);
+        if (width+a>maxWidth&&i>rowStart) {
+            breaks.push_back(i);
+            rowStart=i;
+            width=0;
+        }
+        width+=a;
+    }
+}
+
+// Same rows as the greedy wrap, without looking at the text.
+inline void wrapLine(const Monospace& m,const char*,size_t len,int maxWidth,std::vector<size_t>& breaks) {
+    breaks.clear();
+    if (m.cell<=0) return;
+    size_t perRow=std::max(1,maxWidth/m.cell);
+    for (size_t i=perRow;i<len;i+=perRow) breaks.push_back(i);
+}
+
+// Wrapped rows per logical line, cached by line number. Entries are dropped
+// or renumbered from the LineEdits a buffer reports, and an entry made for
+// another wrap width is reflowed the next time it is asked for, so a resize
+// only costs the lines that are actually looked at. Clear it when the font
+// changes.
+class TextLayout {
+    struct Entry {
+        std::vector<size_t> breaks;
+        int width;
+    };
+    std::unordered_map<size_t,Entry> cache;
+    int wrapWidth=0;
+public:
+    int width() const {
+        return wrapWidth;
+    }
+    void setWidth(int w) {
+        wrapWidth=w;
+    }
+    void apply(const LineEdit& e) {
+        if (e.removed==e.inserted) {
+            for (size_t i=0;i<e.removed;i++) cache.erase(e.first+i);
+            return;
+        }
+        std::unordered_map<size_t,Entry> shifted;
+        shifted.reserve(cache.size());
+        for (auto& kv:cache) {
+            if (kv.first<e.first) {
+                shifted.emplace(kv.first,std::move(kv.second));
+            } else if (kv.first>=e.first+e.removed) {
+                shifted.emplace(kv.first-e.removed+e.inserted,std::move(kv.second));
+            }
+        }
+        cache.swap(shifted);
+    }
+    void apply(const std::vector<LineEdit>& edits) {
+        for (const auto& e:edits) apply(e);
+    }
+    void clear() {
+        cache.clear();
+    }
+    // Drops lines outside [first, last) once the cache outgrows limit.
+    void retain(size_t first,size_t last,size_t limit) {
+        if (cache.size()<=limit) return;
+        for (auto it=cache.begin();it!=cache.end();) {
+            if (it->first<first||it->first>=last) {
+                it=cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Breaks of a line; text() is only called when the line has to be
+    // wrapped again.
+    template<class Text,class Metrics>
+    const std::vector<size_t>& breaks(size_t line,Text&& text,const Metrics& m) {
+        Entry& e=cache[line];
+        if (e.width!=wrapWidth||e.width==0) {
+            std::string_view s=text();
+            wrapLine(m,s.data(),s.size(),wrapWidth,e.breaks);
+            e.width=wrapWidth;
+        }
+        return e.breaks;
+    }
+    template<class Text,class Metrics>
+    size_t rows(size_t line,Text&& text,const Metrics& m) {
+        return breaks(line,text,m).size()+1;
+    }
+};
+#endif
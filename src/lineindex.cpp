@@ -0,0 +1,339 @@
+#ifndef LINE_INDEX
+#define LINE_INDEX
+#include "scan.cpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+// removed lines starting at first were replaced by inserted new ones.
+struct LineEdit {
+    size_t first,removed,inserted;
+};
+
+// Lengths of the lines of a buffer, each including its trailing '\n', kept
+// in an implicit treap whose nodes hold runs of up to CHUNK lines. Line
+// starts, the line holding an offset and edits that grow, split or join
+// lines are all O(log n + CHUNK), at about one size_t per line. There is
+// always at least one line; the last one has no '\n'.
+class LineIndex {
+    static const size_t CHUNK=64;
+    struct Node {
+        int left=-1,right=-1;
+        uint32_t priority=0;
+        size_t count=0;
+        size_t sum=0;
+        size_t bytes=0;
+        std::vector<size_t> lens;
+    };
+    std::vector<Node> nodes;
+    std::vector<int> freeNodes;
+    int root=-1;
+    std::mt19937 rng{0x5eed};
+    size_t count(int n) const {
+        return n<0?0:nodes[n].count;
+    }
+    size_t sum(int n) const {
+        return n<0?0:nodes[n].sum;
+    }
+    void pull(int n) {
+        Node& x=nodes[n];
+        x.count=x.lens.size()+count(x.left)+count(x.right);
+        x.sum=x.bytes+sum(x.left)+sum(x.right);
+    }
+    int alloc(std::vector<size_t>&& lens) {
+        int n;
+        if (!freeNodes.empty()) {
+            n=freeNodes.back();
+            freeNodes.pop_back();
+            nodes[n]=Node();
+        } else {
+            n=nodes.size();
+            nodes.emplace_back();
+        }
+        Node& x=nodes[n];
+        x.priority=rng();
+        x.lens=std::move(lens);
+        for (size_t l:x.lens) x.bytes+=l;
+        pull(n);
+        return n;
+    }
+    void release(int n) {
+        std::vector<int> stack;
+        if (n>=0) stack.push_back(n);
+        while (!stack.empty()) {
+            int x=stack.back();
+            stack.pop_back();
+            if (nodes[x].left>=0) stack.push_back(nodes[x].left);
+            if (nodes[x].right>=0) stack.push_back(nodes[x].right);
+            nodes[x].lens=std::vector<size_t>();
+            freeNodes.push_back(x);
+        }
+    }
+    int merge(int a,int b) {
+        if (a<0) return b;
+        if (b<0) return a;
+        if (nodes[a].priority>=nodes[b].priority) {
+            int r=merge(nodes[a].right,b);
+            nodes[a].right=r;
+            pull(a);
+            return a;
+        }
+        int l=merge(a,nodes[b].left);
+        nodes[b].left=l;
+        pull(b);
+        return b;
+    }
+    // First k lines of n go to a, the rest to b. A chunk straddling the cut
+    // is split in two; the new half inherits its priority so the heap order
+    // holds.
+    void split(int n,size_t k,int& a,int& b) {
+        if (n<0) {
+            a=b=-1;
+            return;
+        }
+        size_t lc=count(nodes[n].left),c=nodes[n].lens.size();
+        int l,r;
+        if (k<=lc) {
+            split(nodes[n].left,k,l,r);
+            nodes[n].left=r;
+            pull(n);
+            a=l;
+            b=n;
+        } else if (k>=lc+c) {
+            split(nodes[n].right,k-lc-c,l,r);
+            nodes[n].right=l;
+            pull(n);
+            a=n;
+            b=r;
+        } else {
+            std::vector<size_t>& lens=nodes[n].lens;
+            std::vector<size_t> tail(lens.begin()+(k-lc),lens.end());
+            lens.resize(k-lc);
+            nodes[n].bytes=0;
+            for (size_t len:lens) nodes[n].bytes+=len;
+            int m=alloc(std::move(tail));
+            nodes[m].priority=nodes[n].priority;
+            nodes[m].right=nodes[n].right;
+            nodes[n].right=-1;
+            pull(n);
+            pull(m);
+            a=n;
+            b=m;
+        }
+    }
+    // Balanced build followed by a sift-down of the random priorities, so a
+    // fresh index costs O(n) instead of n inserts.
+    int build(std::vector<size_t>* chunks,size_t n) {
+        if (n==0) return -1;
+        size_t mid=n/2;
+        int x=alloc(std::move(chunks[mid]));
+        int l=build(chunks,mid);
+        int r=build(chunks+mid+1,n-mid-1);
+        nodes[x].left=l;
+        nodes[x].right=r;
+        for (int y=x;;) {
+            int big=y;
+            int yl=nodes[y].left,yr=nodes[y].right;
+            if (yl>=0&&nodes[yl].priority>nodes[big].priority) big=yl;
+            if (yr>=0&&nodes[yr].priority>nodes[big].priority) big=yr;
+            if (big==y) break;
+            std::swap(nodes[y].priority,nodes[big].priority);
+            y=big;
+        }
+        pull(x);
+        return x;
+    }
+    int build(const std::vector<size_t>& lens) {
+        std::vector<std::vector<size_t>> chunks;
+        for (size_t i=0;i<lens.size();i+=CHUNK) {
+            size_t end=std::min(lens.size(),i+CHUNK);
+            chunks.emplace_back(lens.begin()+i,lens.begin()+end);
+        }
+        return build(chunks.data(),chunks.size());
+    }
+    // Node holding a line and the line's position inside its chunk.
+    int find(size_t line,size_t& i) const {
+        int n=root;
+        while (n>=0) {
+            size_t lc=count(nodes[n].left),c=nodes[n].lens.size();
+            if (line<lc) {
+                n=nodes[n].left;
+            } else if (line<lc+c) {
+                i=line-lc;
+                return n;
+            } else {
+                line-=lc+c;
+                n=nodes[n].right;
+            }
+        }
+        return -1;
+    }
+    int leftmost(int n) const {
+        while (n>=0&&nodes[n].left>=0) n=nodes[n].left;
+        return n;
+    }
+    int rightmost(int n) const {
+        while (n>=0&&nodes[n].right>=0) n=nodes[n].right;
+        return n;
+    }
+public:
+    LineIndex() {
+        root=alloc({0});
+    }
+    // Line lengths of a piece of text, the last one without a '\n'.
+    static std::vector<size_t> measure(const char* text,size_t len) {
+        std::vector<size_t> lens;
+        size_t begin=0;
+        scan::for_each_newline(text,len,[&](size_t nl) {
+            lens.push_back(nl+1-begin);
+            begin=nl+1;
+        });
+        lens.push_back(len-begin);
+        return lens;
+    }
+    void assign(const std::vector<size_t>& lens) {
+        nodes.clear();
+        freeNodes.clear();
+        root=lens.empty()?alloc({0}):build(lens);
+    }
+    // Scans straight into chunks, without a flat array of every line.
+    void assign(const char* text,size_t len) {
+        assignPieces([&](auto&& piece) {
+            piece(text,len);
+            return true;
+        });
+    }
+    // The same over text handed over in consecutive pieces: source(piece)
+    // calls piece(const char* p, size_t n) on each and returns false if it
+    // couldn't finish, which leaves the index as it was.
+    template<class Source>
+    bool assignPieces(Source&& source) {
+        std::vector<std::vector<size_t>> chunks;
+        std::vector<size_t> chunk;
+        chunk.reserve(CHUNK);
+        size_t begin=0,at=0;
+        bool whole=source([&](const char* p,size_t n) {
+            scan::for_each_newline(p,n,[&](size_t nl) {
+                chunk.push_back(at+nl+1-begin);
+                begin=at+nl+1;
+                if (chunk.size()==CHUNK) {
+                    chunks.push_back(std::move(chunk));
+                    chunk=std::vector<size_t>();
+                    chunk.reserve(CHUNK);
+                }
+            });
+            at+=n;
+        });
+        if (!whole) return false;
+        chunk.push_back(at-begin);
+        chunks.push_back(std::move(chunk));
+        nodes.clear();
+        freeNodes.clear();
+        nodes.reserve(chunks.size());
+        root=build(chunks.data(),chunks.size());
+        return true;
+    }
+    size_t lines() const {
+        return count(root);
+    }
+    size_t bytes() const {
+        return sum(root);
+    }
+    // Length of a line including its '\n'.
+    size_t length(size_t line) const {
+        size_t i;
+        int n=find(line,i);
+        return n<0?0:nodes[n].lens[i];
+    }
+    size_t start(size_t line) const {
+        size_t pos=0;
+        int n=root;
+        while (n>=0) {
+            const Node& x=nodes[n];
+            size_t lc=count(x.left),c=x.lens.size();
+            if (line<lc) {
+                n=x.left;
+            } else if (line<lc+c) {
+                pos+=sum(x.left);
+                for (size_t i=0;i<line-lc;i++) pos+=x.lens[i];
+                return pos;
+            } else {
+                pos+=sum(x.left)+x.bytes;
+                line-=lc+c;
+                n=x.right;
+            }
+        }
+        return pos;
+    }
+    // Line holding the byte at offset; offsets past the end map to the last line.
+    size_t lineOf(size_t offset) const {
+        size_t line=0;
+        int n=root;
+        while (n>=0) {
+            const Node& x=nodes[n];
+            size_t ls=sum(x.left);
+            if (offset<ls) {
+                n=x.left;
+            } else if (offset<ls+x.bytes) {
+                offset-=ls;
+                line+=count(x.left);
+                for (size_t i=0;;i++) {
+                    if (offset<x.lens[i]) return line+i;
+                    offset-=x.lens[i];
+                }
+            } else {
+                offset-=ls+x.bytes;
+                line+=count(x.left)+x.lens.size();
+                n=x.right;
+            }
+        }
+        return lines()-1;
+    }
+    void resize(size_t line,long delta) {
+        int n=root;
+        while (n>=0) {
+            Node& x=nodes[n];
+            x.sum+=delta;
+            size_t lc=count(x.left),c=x.lens.size();
+            if (line<lc) {
+                n=x.left;
+            } else if (line<lc+c) {
+                x.lens[line-lc]+=delta;
+                x.bytes+=delta;
+                return;
+            } else {
+                line-=lc+c;
+                n=x.right;
+            }
+        }
+    }
+    // Replaces num lines starting at first with lines of the given
+    // lengths. The chunks on either side of the cut are rebuilt together
+    // with the new lines so repeated edits don't fragment the index.
+    void replace(size_t first,size_t num,const std::vector<size_t>& lens) {
+        int a,rest,mid,b,edge;
+        split(root,first,a,rest);
+        split(rest,num,mid,b);
+        release(mid);
+        std::vector<size_t> joined;
+        int last=rightmost(a);
+        if (last>=0) {
+            split(a,count(a)-nodes[last].lens.size(),a,edge);
+            joined=nodes[edge].lens;
+            release(edge);
+        }
+        joined.insert(joined.end(),lens.begin(),lens.end());
+        int next=leftmost(b);
+        if (next>=0) {
+            split(b,nodes[next].lens.size(),edge,b);
+            joined.insert(joined.end(),nodes[edge].lens.begin(),nodes[edge].lens.end());
+            release(edge);
+        }
+        root=merge(merge(a,build(joined)),b);
+        if (root<0) root=alloc({0});
+    }
+};
+#endif
@@ -1,23 +1,140 @@
 #include "file.cpp"
 #include "timer.cpp"
 #include "codingwindow.cpp"
+#include "session.cpp"
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <ostream>
+#include <string>
+#include <unistd.h>
 
+// Writes a replayed session's starting text to a temporary file for the
+// File to open. Empty on failure.
+std::string extractSessionFile(const SessionReader& session) {
+    const char* tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/fate-replay-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) return "";
+    const std::string& text = session.fileText();
+    bool ok = write(fd, text.data(), text.size()) == (ssize_t)text.size();
+    close(fd);
+    if (!ok) {
+        unlink(path.c_str());
+        return "";
+    }
+    return path;
+}
+
+// fate [options] [FILE]
+//   --unlocked        present as fast as possible instead of on vblank
+//   --latency         log each keystroke's time to present to stderr
+//   --trace=FILE      where F12 writes a Chrome trace; also written on exit
+//   --record=SESSION  record the input to SESSION
+//   --replay=SESSION  play SESSION back headless, then exit
+//   --max-speed       replay without waiting between events (and unlocked)
+//   --headless        without --replay: draw FILE into a hidden, software-
+//                     rendered window, scrolling it a wheel notch a frame
+//                     as fast as frames can be drawn, then exit
+//   --frames=N        how many frames --headless draws (300)
+//   --dump-frames=DIR write every presented frame to DIR as a PNG
+//   --report=FILE     per-frame timings and latencies as JSON lines; stdout
+//                     by default when headless
 int main(int argc, char** argv) {
-    Window window("Text Editor", 1000, 800);
-    CodingWindow cw("main.cpp",&window,1000,800,20,"FiraCode");
-    while (window.running) {
-        //Timer t;
-        window.pollEvents();
-        window.clear({30, 30, 30, 255});
-        cw.update();
-        cw.render();
-        window.present();
-        setFrameRate(60);
-        //int millis=t.now();
-        //std::cout<<"Frame rate: "<<1000.0/millis<<std::endl;
+    FrameScheduler::Options frames;
+    // F12 writes a Chrome trace of the last few seconds to tracePath;
+    // --trace=FILE picks the file and writes one on exit as well.
+    std::string tracePath = "fate-trace.json";
+    bool traceOnExit = false;
+    std::string filename = "main.cpp";
+    std::string recordPath, replayPath, reportPath;
+    bool maxSpeed = false, headless = false;
+    int frameCount = 300;
+    std::string frameDir;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--unlocked") frames.unlocked = true;
+        else if (arg == "--latency") frames.logLatency = true;
+        else if (arg == "--max-speed") maxSpeed = true;
+        else if (arg == "--headless") headless = true;
+        else if (arg.rfind("--trace=", 0) == 0) {
+            tracePath = arg.substr(8);
+            traceOnExit = true;
+        }
+        else if (arg.rfind("--record=", 0) == 0) recordPath = arg.substr(9);
+        else if (arg.rfind("--replay=", 0) == 0) replayPath = arg.substr(9);
+        else if (arg.rfind("--report=", 0) == 0) reportPath = arg.substr(9);
+        else if (arg.rfind("--frames=", 0) == 0) frameCount = atoi(arg.c_str() + 9);
+        else if (arg.rfind("--dump-frames=", 0) == 0) frameDir = arg.substr(14);
+        else if (arg.rfind("--", 0) == 0) std::cerr << "Unknown option " << arg << std::endl;
+        else filename = arg;
+    }
+    int width = 1000, height = 800;
+    std::unique_ptr<SessionReader> replay;
+    if (!replayPath.empty()) {
+        replay.reset(SessionReader::open(replayPath, !maxSpeed));
+        if (!replay) {
+            std::cerr << "Can't read session " << replayPath << std::endl;
+            return 1;
+        }
+        filename = extractSessionFile(*replay);
+        if (filename.empty()) {
+            std::cerr << "Can't write the session's file" << std::endl;
+            return 1;
+        }
+        width = replay->Width();
+        height = replay->Height();
+        headless = true;
     }
-    
+    // Paced like a 60 Hz display only when replaying in real time.
+    if (headless && (!replay || maxSpeed)) frames.unlocked = true;
+    FILE* report = nullptr;
+    if (!reportPath.empty()) {
+        report = fopen(reportPath.c_str(), "w");
+        if (!report) std::cerr << "Can't write report " << reportPath << std::endl;
+    } else if (headless) {
+        report = stdout;
+    }
+    frames.report = report;
+    std::unique_ptr<SessionWriter> recorder;
+    if (!recordPath.empty()) {
+        recorder.reset(SessionWriter::create(recordPath, filename, width, height));
+        if (!recorder) std::cerr << "Can't write session " << recordPath << std::endl;
+    }
+    TRACE_THREAD("main");
+    Window window("Text Editor", width, height, headless);
+    window.recorder = recorder.get();
+    window.player = replay.get();
+    {
+        CodingWindow cw(filename,&window,width,height,20,"FiraCode",frames,frameDir);
+        if (replay) unlink(filename.c_str());
+        if (headless && !replay) {
+            // Down through the file and back up, each frame drawn before
+            // the next is asked for.
+            long notches = std::max<long>(1, cw.lineCount() / 3);
+            for (int i = 0; i < frameCount; i++) {
+                window.pollEvents();
+                window.scrollY = (i / notches) % 2 ? 1 : -1;
+                cw.update();
+                cw.finish();
+            }
+            window.running = false;
+        }
+        while (window.running) {
+            int timeout = cw.nextDeadline();
+            int repeat = window.keys.nextDeadline(window.ticks());
+            if (repeat >= 0 && (timeout < 0 || repeat < timeout)) timeout = repeat;
+            window.waitEvents(timeout);
+            cw.update();
+            if (window.keys.pressed(SDL_SCANCODE_F12) && Tracer::instance().dump(tracePath)) {
+                std::cerr << "Trace written to " << tracePath << std::endl;
+            }
+        }
+        if (replay) cw.finish();
+    }
+    if (report && report != stdout) fclose(report);
+    if (traceOnExit) Tracer::instance().dump(tracePath);
+
     return 0;
 }
@@ -0,0 +1,224 @@
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <ext/rope>
+#include <csetjmp>
+#include <csignal>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mappedfile {
+// Where a SIGBUS on this thread jumps to, while a copy out of a mapping is
+// under way.
+inline thread_local sigjmp_buf* guard=nullptr;
+inline struct sigaction previousBus,previousIo;
+// Hands a signal on to the handler that was there before ours.
+inline void chain(const struct sigaction& previous,int sig,siginfo_t* info,void* context) {
+    if (previous.sa_flags&SA_SIGINFO) previous.sa_sigaction(sig,info,context);
+    else if (previous.sa_handler!=SIG_DFL&&previous.sa_handler!=SIG_IGN) previous.sa_handler(sig);
+}
+// The handler stays for the life of the process. A fault that isn't ours
+// goes to the handler before it, or if there was none gets the default
+// action back and happens again, killing the process as it would have.
+inline void onBus(int sig,siginfo_t* info,void* context) {
+    if (guard) siglongjmp(*guard,1);
+    if (!(previousBus.sa_flags&SA_SIGINFO)&&(previousBus.sa_handler==SIG_DFL||previousBus.sa_handler==SIG_IGN)) {
+        signal(SIGBUS,SIG_DFL);
+        return;
+    }
+    chain(previousBus,sig,info,context);
+}
+
+// The read leases held on mapped files, as slots a signal handler can walk.
+struct Lease {
+    enum { FREE, CLAIMED, HELD, COPYING, COPIED };
+    std::atomic<int> state{FREE};
+    int fd=-1;
+    char* base=nullptr;
+    size_t len=0;
+};
+inline Lease leases[64];
+// Swaps the file's pages for an anonymous copy at the same address, then
+// lets the lease go. Only async-signal-safe calls: it runs in onIo.
+inline void copyOut(Lease& l) {
+    void* p=mmap(nullptr,l.len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (p!=MAP_FAILED) {
+        memcpy(p,l.base,l.len);
+        mprotect(p,l.len,PROT_READ);
+        if (mremap(p,l.len,l.len,MREMAP_MAYMOVE|MREMAP_FIXED,l.base)==MAP_FAILED) munmap(p,l.len);
+    }
+    fcntl(l.fd,F_SETLEASE,F_UNLCK);
+    close(l.fd);
+    l.fd=-1;
+}
+// A lease break: someone is opening one of the files to write it or
+// truncating it, and is held up until the lease goes or lease-break-time
+// runs out. SIGIO isn't queued, so check every lease rather than si_fd.
+inline void onIo(int sig,siginfo_t* info,void* context) {
+    bool ours=false;
+    for (Lease& l:leases) {
+        int held=Lease::HELD;
+        if (l.state.load()!=Lease::HELD||fcntl(l.fd,F_GETLEASE)==F_RDLCK) continue;
+        if (!l.state.compare_exchange_strong(held,Lease::COPYING)) continue;
+        copyOut(l);
+        l.state.store(Lease::COPIED);
+        ours=true;
+    }
+    if (!ours) chain(previousIo,sig,info,context);
+}
+inline void install() {
+    static bool installed=[] {
+        struct sigaction sa{};
+        sa.sa_sigaction=onBus;
+        // NODEFER so the jump out needn't restore the signal mask, which
+        // would cost a syscall per copy.
+        sa.sa_flags=SA_SIGINFO|SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        bool ok=sigaction(SIGBUS,&sa,&previousBus)==0;
+        sa.sa_sigaction=onIo;
+        sa.sa_flags=SA_SIGINFO|SA_RESTART;
+        return ok&&sigaction(SIGIO,&sa,&previousIo)==0;
+    }();
+    (void)installed;
+}
+// A read lease on fd covering base, or nullptr if the file can't have one
+// (not ours, open for writing elsewhere, leases off, no slot left).
+inline Lease* lease(int fd,char* base,size_t len) {
+    for (Lease& l:leases) {
+        int free=Lease::FREE;
+        if (!l.state.compare_exchange_strong(free,Lease::CLAIMED)) continue;
+        l.fd=fd;
+        l.base=base;
+        l.len=len;
+        if (fcntl(fd,F_SETLEASE,F_RDLCK)!=0) {
+            l.state.store(Lease::FREE);
+            return nullptr;
+        }
+        l.state.store(Lease::HELD);
+        // onIo skips claimed slots, so take care of a break that came in
+        // before the lease was marked held.
+        int held=Lease::HELD;
+        if (fcntl(fd,F_GETLEASE)!=F_RDLCK&&l.state.compare_exchange_strong(held,Lease::COPYING)) {
+            copyOut(l);
+            l.state.store(Lease::COPIED);
+        }
+        return &l;
+    }
+    return nullptr;
+}
+// Gives the lease up, waiting out a copy onIo is making of it.
+inline void release(Lease& l) {
+    int held=Lease::HELD;
+    if (l.state.compare_exchange_strong(held,Lease::CLAIMED)) {
+        fcntl(l.fd,F_SETLEASE,F_UNLCK);
+        close(l.fd);
+    } else {
+        while (l.state.load()!=Lease::COPIED) sched_yield();
+    }
+    l.fd=-1;
+    l.state.store(Lease::FREE);
+}
+}
+
+// A read-only mapping of a file, usable as a lazily evaluated rope leaf.
+// Hand it to a rope with delete_fn set and the pages stay mapped for as long
+// as any rope still shares the original text; only the pieces that edits
+// split off small enough get copied.
+//
+// Pages are read from the file as they are first touched, so another
+// process rewriting it in place would change the text under the editor
+// and its line index, and truncating it (a log rotated with copytruncate,
+// `> file`) would leave pages that fault with SIGBUS. The mapping only
+// exists under a read lease: whoever opens the file to write it or
+// truncates it waits while onIo copies the whole mapping into memory, and
+// then changes a file the editor no longer reads. Files that can't be
+// leased aren't mapped, and File reads them the ordinary way. As a last
+// line of defence every read goes through read(), which catches SIGBUS:
+// text that is gone reads back as NUL bytes instead of killing the editor.
+class MappedFile : public __gnu_cxx::char_producer<char> {
+    char* base;
+    size_t len;
+    mappedfile::Lease* lease;
+    MappedFile(char* base,size_t len,mappedfile::Lease* lease): base(base),len(len),lease(lease) {}
+public:
+    // nullptr if the file can't be mapped (missing, empty, not a regular
+    // file, no lease).
+    static MappedFile* open(const std::string& filename) {
+        int fd=::open(filename.c_str(),O_RDONLY|O_CLOEXEC);
+        if (fd<0) return nullptr;
+        struct stat st;
+        if (fstat(fd,&st)!=0||!S_ISREG(st.st_mode)||st.st_size==0) {
+            close(fd);
+            return nullptr;
+        }
+        void* p=mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (p==MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+        mappedfile::install();
+        mappedfile::Lease* lease=mappedfile::lease(fd,(char*)p,st.st_size);
+        if (!lease) {
+            munmap(p,st.st_size);
+            close(fd);
+            return nullptr;
+        }
+        return new MappedFile((char*)p,st.st_size,lease);
+    }
+    MappedFile(const MappedFile&)=delete;
+    MappedFile& operator=(const MappedFile&)=delete;
+    ~MappedFile() {
+        mappedfile::release(*lease);
+        munmap(base,len);
+    }
+    // The mapping itself; reading it directly is only safe while nothing
+    // can fault, which the lease all but guarantees.
+    const char* data() const {
+        return base;
+    }
+    size_t size() const {
+        return len;
+    }
+    void advise(int advice) {
+        madvise(base,len,advice);
+    }
+    // Copies [start, start + n) to buffer; false if part of it is gone
+    // from the file, leaving buffer partly written.
+    bool read(size_t start,size_t n,char* buffer) const {
+        sigjmp_buf env;
+        sigjmp_buf* outer=mappedfile::guard;
+        if (sigsetjmp(env,0)) {
+            mappedfile::guard=outer;
+            return false;
+        }
+        mappedfile::guard=&env;
+        memcpy(buffer,base+start,n);
+        mappedfile::guard=outer;
+        return true;
+    }
+    // Calls fn(const char* p, size_t n) on copies of the whole file, BLOCK
+    // bytes at a time; false if it couldn't all be read.
+    template<class Fn>
+    bool forEachBlock(Fn&& fn) const {
+        const size_t BLOCK=256*1024;
+        std::vector<char> buffer(std::min(len,BLOCK));
+        for (size_t at=0;at<len;at+=BLOCK) {
+            size_t n=std::min(len-at,BLOCK);
+            if (!read(at,n,buffer.data())) return false;
+            fn(buffer.data(),n);
+        }
+        return true;
+    }
+    void operator()(size_t start,size_t n,char* buffer) override {
+        if (!read(start,n,buffer)) memset(buffer,0,n);
+    }
+};
+#endif
@@ -0,0 +1,68 @@
+#ifndef PERF_HUD
+#define PERF_HUD
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "drawing.cpp"
+#include "profiler.cpp"
+
+// Overlay with the Profiler's zone percentiles, the glyph cache hit rate and
+// allocations per frame, drawn in the corner of the window through a
+// Texture of its own. Prepared on the layout thread and drawn on the
+// window's, like a TextView; F3 toggles it.
+class PerfHud {
+    static const int COLUMNS=48;
+    static const int LINES=ZONE_COUNT+3;
+    static const int PADDING=6;
+    Texture t;
+    int font;
+    std::vector<uint32_t> scratch;
+    char line[COLUMNS+1];
+    size_t lastHits=0,lastMisses=0;
+    unsigned long long lastAllocations=0;
+    SDL_Color bg={20,18,30,220};
+    SDL_Color fg={250,244,237,255};
+    SDL_Color dim={160,156,180,255};
+    void print(int row,SDL_Color color) {
+        int lineHeight=t.getMetrics(font).lineHeight;
+        t.queueText(font,line,strlen(line),PADDING,PADDING+row*lineHeight,color);
+    }
+public:
+    bool visible=false;
+    PerfHud(SDL_Renderer* r,const std::string& fontPath,int fontSize): t(r,1,1) {
+        font=t.loadFont(fontPath,fontSize);
+        const FontMetrics& m=t.getMetrics(font);
+        t.resize(COLUMNS*m.prop.advance('0')+2*PADDING,LINES*m.lineHeight+2*PADDING);
+    }
+    // Call once per presented frame, visible or not, so the per-frame
+    // counts cover one frame.
+    void prepare(size_t hits,size_t misses) {
+        unsigned long long allocations=allocationCount.load(std::memory_order_relaxed);
+        size_t frameHits=hits-lastHits,frameMisses=misses-lastMisses;
+        unsigned long long frameAllocations=allocations-lastAllocations;
+        lastHits=hits;
+        lastMisses=misses;
+        lastAllocations=allocations;
+        if (!visible||!t.getFont(font)) return;
+        t.clear(bg);
+        snprintf(line,sizeof(line),"%-8s %8s %8s %8s %8s","ms","p50","p95","p99","max");
+        print(0,dim);
+        for (int z=0;z<ZONE_COUNT;z++) {
+            Histogram::Summary s=Profiler::instance().zone((Zone)z).summary(scratch);
+            snprintf(line,sizeof(line),"%-8s %8.3f %8.3f %8.3f %8.3f",ZONE_NAMES[z],s.p50/1e6,s.p95/1e6,s.p99/1e6,s.max/1e6);
+            print(1+z,fg);
+        }
+        size_t lookups=hits+misses;
+        snprintf(line,sizeof(line),"glyphs   %5.1f%% hit, %zu/%zu missed",lookups?100.0*hits/lookups:100.0,frameMisses,frameHits+frameMisses);
+        print(ZONE_COUNT+1,fg);
+        snprintf(line,sizeof(line),"allocs   %llu this frame, %llu total",frameAllocations,allocations);
+        print(ZONE_COUNT+2,fg);
+    }
+    void draw(Window* window) {
+        if (!visible||!t.getFont(font)) return;
+        int x=window->PixelWidth()-t.Width();
+        window->drawTexture(t,{0,0,t.Width(),t.Height()},{x>0?x:0,0,t.Width(),t.Height()});
+    }
+};
+#endif
@@ -0,0 +1,149 @@
+#ifndef PROFILER
+#define PROFILER
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "timer.cpp"
+#include "trace.cpp"
+
+// Every operator new in the program, counted for the performance HUD. All
+// the replaceable forms are defined here, array and aligned ones included,
+// so that each allocation is counted and freed by a matching pair; the
+// nothrow forms call these. They stay out of line: inlined, GCC would see
+// malloc on one side and free on the other and warn that they mismatch.
+inline std::atomic<unsigned long long> allocationCount{0};
+namespace profiler {
+// What this thread's operator new has taken from the heap, each block
+// counted as glibc's malloc carves it out: a size word, rounded up to 16
+// bytes, 32 at least. Read before and after an operation, it tells what
+// the operation allocated without other threads in the count.
+inline thread_local size_t allocatedBytes=0;
+inline void countBlock(size_t size) {
+    allocatedBytes+=std::max<size_t>(32,(size+sizeof(size_t)+15)&~(size_t)15);
+}
+inline void* allocate(size_t size) {
+    allocationCount.fetch_add(1,std::memory_order_relaxed);
+    countBlock(size);
+    if (void* p=std::malloc(size?size:1)) return p;
+    throw std::bad_alloc();
+}
+inline void* allocate(size_t size,std::align_val_t align) {
+    allocationCount.fetch_add(1,std::memory_order_relaxed);
+    size_t a=std::max(sizeof(void*),(size_t)align);
+    countBlock(size+a);
+    if (void* p=std::aligned_alloc(a,(std::max<size_t>(size,1)+a-1)/a*a)) return p;
+    throw std::bad_alloc();
+}
+}
+__attribute__((noinline)) void* operator new(size_t size) {
+    return profiler::allocate(size);
+}
+__attribute__((noinline)) void* operator new[](size_t size) {
+    return profiler::allocate(size);
+}
+__attribute__((noinline)) void* operator new(size_t size,std::align_val_t align) {
+    return profiler::allocate(size,align);
+}
+__attribute__((noinline)) void* operator new[](size_t size,std::align_val_t align) {
+    return profiler::allocate(size,align);
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p,size_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p,size_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p,std::align_val_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p,std::align_val_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete(void* p,size_t,std::align_val_t) noexcept {
+    std::free(p);
+}
+__attribute__((noinline)) void operator delete[](void* p,size_t,std::align_val_t) noexcept {
+    std::free(p);
+}
+
+// The last SIZE durations of one zone, in nanoseconds. One thread adds and
+// any other may summarize; samples are atomics, so a summary racing an add
+// is at worst one sample out of date.
+class Histogram {
+    static constexpr size_t SIZE=256;
+    std::array<std::atomic<uint32_t>,SIZE> samples{};
+    std::atomic<size_t> count{0};
+public:
+    struct Summary {
+        size_t samples=0;
+        long long p50=0,p95=0,p99=0,max=0;
+    };
+    void add(long long ns) {
+        size_t n=count.load(std::memory_order_relaxed);
+        samples[n%SIZE].store((uint32_t)std::min<long long>(std::max(ns,0LL),UINT32_MAX),std::memory_order_relaxed);
+        count.store(n+1,std::memory_order_release);
+    }
+    Summary summary(std::vector<uint32_t>& scratch) const {
+        Summary s;
+        s.samples=std::min(count.load(std::memory_order_acquire),SIZE);
+        if (s.samples==0) return s;
+        scratch.resize(s.samples);
+        for (size_t i=0;i<s.samples;i++) scratch[i]=samples[i].load(std::memory_order_relaxed);
+        std::sort(scratch.begin(),scratch.end());
+        auto at=[&](size_t pct) { return (long long)scratch[(s.samples-1)*pct/100]; };
+        s.p50=at(50);
+        s.p95=at(95);
+        s.p99=at(99);
+        s.max=scratch.back();
+        return s;
+    }
+};
+
+enum Zone { ZONE_FRAME, ZONE_POLL, ZONE_EDIT, ZONE_LAYOUT, ZONE_RASTER, ZONE_DRAW, ZONE_PRESENT, ZONE_COUNT };
+const char* const ZONE_NAMES[ZONE_COUNT]={"frame","poll","edit","layout","raster","draw","present"};
+
+// Rolling duration histograms of the stages of a frame, shared by the
+// window's thread and the layout thread.
+class Profiler {
+    Histogram zones[ZONE_COUNT];
+    Profiler() {}
+public:
+    Profiler(const Profiler&)=delete;
+    Profiler& operator=(const Profiler&)=delete;
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+    Histogram& zone(Zone z) {
+        return zones[z];
+    }
+};
+
+// Adds the time from construction to destruction to a zone, and traces
+// it as a slice of the same name.
+class ScopedZone {
+    Zone zone;
+    Histogram& histogram;
+    Timer timer{false};
+public:
+    ScopedZone(Zone z): zone(z),histogram(Profiler::instance().zone(z)) {
+        TRACE_BEGIN(ZONE_NAMES[z]);
+    }
+    ScopedZone(const ScopedZone&)=delete;
+    ScopedZone& operator=(const ScopedZone&)=delete;
+    ~ScopedZone() {
+        TRACE_END(ZONE_NAMES[zone]);
+        histogram.add(timer.nanos());
+    }
+};
+#endif
@@ -0,0 +1,72 @@
+#ifndef ROPE_CHUNKS
+#define ROPE_CHUNKS
+#include "scan.cpp"
+#include <algorithm>
+#include <ext/rope>
+#include <string>
+typedef __gnu_cxx::crope rope;
+
+// Contiguous runs of a rope, for scans that would otherwise pay a tree
+// descent (or an iterator's cache refill) per character. Leaves are handed
+// over in place; lazily produced text, such as a MappedFile's, is copied
+// out a window at a time, starting small so that a short read near begin
+// doesn't pull in a large block, and doubling up to MAX_WINDOW.
+namespace ropechunks {
+const size_t MIN_WINDOW=256;
+const size_t MAX_WINDOW=64*1024;
+
+template<class Fn>
+class Consumer : public __gnu_cxx::_Rope_char_consumer<char> {
+    Fn& fn;
+public:
+    bool stopped=false;
+    Consumer(Fn& fn): fn(fn) {}
+    bool operator()(const char* p,size_t n) override {
+        if (n==0) return true;
+        stopped=!fn(p,n);
+        return !stopped;
+    }
+};
+}
+
+// Calls fn(const char* p, size_t n) on successive pieces of [begin, end)
+// until it returns false; returns false if fn stopped it.
+template<class Fn>
+bool for_each_chunk(const rope& r,size_t begin,size_t end,Fn&& fn) {
+    end=std::min(end,r.size());
+    ropechunks::Consumer<Fn> consumer(fn);
+    size_t window=ropechunks::MIN_WINDOW;
+    while (begin<end) {
+        size_t to=end-begin>window?begin+window:end;
+        r.apply_to_pieces(begin,to,consumer);
+        if (consumer.stopped) return false;
+        begin=to;
+        window=std::min(window*2,ropechunks::MAX_WINDOW);
+    }
+    return true;
+}
+
+// Appends [begin, end) of r to out.
+inline void append_range(const rope& r,size_t begin,size_t end,std::string& out) {
+    if (end>begin) out.reserve(out.size()+std::min(end,r.size())-std::min(begin,r.size()));
+    for_each_chunk(r,begin,end,[&](const char* p,size_t n) {
+        out.append(p,n);
+        return true;
+    });
+}
+
+// Offset of the first c at or after begin, or r.size() if there is none.
+inline size_t find_in_rope(const rope& r,char c,size_t begin) {
+    size_t found=r.size();
+    size_t pos=begin;
+    for_each_chunk(r,begin,r.size(),[&](const char* p,size_t n) {
+        if (const char* hit=scan::find_byte(p,n,c)) {
+            found=pos+(hit-p);
+            return false;
+        }
+        pos+=n;
+        return true;
+    });
+    return found;
+}
+#endif
@@ -0,0 +1,224 @@
+#ifndef SCAN
+#define SCAN
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+// Byte-scanning kernels for contiguous text: count a byte, count UTF-8
+// codepoints, and list the offsets of every '\n'. On x86-64 there are SSE2
+// and AVX2 versions, the best the CPU supports picked on first use;
+// elsewhere, and for the tails, plain loops. FATE_SCAN=scalar or sse2 in
+// the environment holds the choice down, for comparing them.
+namespace scan {
+
+// The most bytes newline_offsets takes in one call.
+const size_t BLOCK=4096;
+
+struct Kernels {
+    const char* name;
+    size_t (*count_byte)(const char* p,size_t n,char c);
+    size_t (*count_codepoints)(const char* p,size_t n);
+    // Writes the offset of each '\n' in p[0, n), n <= BLOCK, to out and
+    // returns how many there were. out needs room for n + 3: the AVX2
+    // version writes offsets four at a time and may leave junk past the end.
+    size_t (*newline_offsets)(const char* p,size_t n,uint32_t* out);
+};
+
+namespace scalar {
+inline size_t count_byte(const char* p,size_t n,char c) {
+    size_t count=0;
+    for (size_t i=0;i<n;i++) count+=p[i]==c;
+    return count;
+}
+// Continuation bytes are 10xxxxxx; every other byte starts a codepoint.
+inline size_t count_codepoints(const char* p,size_t n) {
+    size_t count=0;
+    for (size_t i=0;i<n;i++) count+=((unsigned char)p[i]&0xC0)!=0x80;
+    return count;
+}
+inline size_t newline_offsets(const char* p,size_t n,uint32_t* out) {
+    size_t count=0;
+    for (const char* at=p;const char* nl=(const char*)memchr(at,'\n',p+n-at);at=nl+1) out[count++]=nl-p;
+    return count;
+}
+}
+
+#if SCAN_X86
+// The counts gather matches in byte lanes, subtracting each compare's -1s,
+// and sum the lanes up before 256 of them could wrap one.
+namespace sse2 {
+inline size_t sum_bytes(__m128i acc) {
+    __m128i sums=_mm_sad_epu8(acc,_mm_setzero_si128());
+    return _mm_cvtsi128_si32(sums)+_mm_extract_epi16(sums,4);
+}
+inline size_t count_byte(const char* p,size_t n,char c) {
+    __m128i needle=_mm_set1_epi8(c);
+    size_t count=0,i=0;
+    while (n-i>=16) {
+        size_t stop=n-i>=255*16?i+255*16:n-(n-i)%16;
+        __m128i acc=_mm_setzero_si128();
+        for (;i<stop;i+=16) acc=_mm_sub_epi8(acc,_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p+i)),needle));
+        count+=sum_bytes(acc);
+    }
+    return count+scalar::count_byte(p+i,n-i,c);
+}
+// As signed bytes, continuation bytes are exactly those below -64.
+inline size_t count_codepoints(const char* p,size_t n) {
+    __m128i bound=_mm_set1_epi8(-64);
+    size_t continuations=0,i=0;
+    while (n-i>=16) {
+        size_t stop=n-i>=255*16?i+255*16:n-(n-i)%16;
+        __m128i acc=_mm_setzero_si128();
+        for (;i<stop;i+=16) acc=_mm_sub_epi8(acc,_mm_cmplt_epi8(_mm_loadu_si128((const __m128i*)(p+i)),bound));
+        continuations+=sum_bytes(acc);
+    }
+    return i-continuations+scalar::count_codepoints(p+i,n-i);
+}
+inline size_t newline_offsets(const char* p,size_t n,uint32_t* out) {
+    __m128i needle=_mm_set1_epi8('\n');
+    size_t count=0,i=0;
+    for (;n-i>=64;i+=64) {
+        __m128i hits[4];
+        for (int k=0;k<4;k++) hits[k]=_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p+i+16*k)),needle);
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(hits[0],hits[1]),_mm_or_si128(hits[2],hits[3])))) continue;
+        uint64_t mask=0;
+        for (int k=0;k<4;k++) mask|=(uint64_t)_mm_movemask_epi8(hits[k])<<16*k;
+        for (;mask;mask&=mask-1) out[count++]=i+__builtin_ctzll(mask);
+    }
+    for (;i<n;i++) if (p[i]=='\n') out[count++]=i;
+    return count;
+}
+}
+
+namespace avx2 {
+__attribute__((target("avx2"))) inline size_t sum_bytes(__m256i acc) {
+    __m256i sums=_mm256_sad_epu8(acc,_mm256_setzero_si256());
+    __m128i half=_mm_add_epi64(_mm256_castsi256_si128(sums),_mm256_extracti128_si256(sums,1));
+    return _mm_cvtsi128_si64(half)+_mm_extract_epi64(half,1);
+}
+__attribute__((target("avx2"))) inline size_t count_byte(const char* p,size_t n,char c) {
+    __m256i needle=_mm256_set1_epi8(c);
+    size_t count=0,i=0;
+    while (n-i>=32) {
+        size_t stop=n-i>=255*32?i+255*32:n-(n-i)%32;
+        __m256i acc=_mm256_setzero_si256();
+        for (;i<stop;i+=32) acc=_mm256_sub_epi8(acc,_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i)),needle));
+        count+=sum_bytes(acc);
+    }
+    return count+sse2::count_byte(p+i,n-i,c);
+}
+__attribute__((target("avx2"))) inline size_t count_codepoints(const char* p,size_t n) {
+    __m256i bound=_mm256_set1_epi8(-64);
+    size_t continuations=0,i=0;
+    while (n-i>=32) {
+        size_t stop=n-i>=255*32?i+255*32:n-(n-i)%32;
+        __m256i acc=_mm256_setzero_si256();
+        for (;i<stop;i+=32) acc=_mm256_sub_epi8(acc,_mm256_cmpgt_epi8(bound,_mm256_loadu_si256((const __m256i*)(p+i))));
+        continuations+=sum_bytes(acc);
+    }
+    return i-continuations+sse2::count_codepoints(p+i,n-i);
+}
+// 128 bytes a step, skipped with one test when they hold no newline;
+// otherwise their offsets are written four at a time, branching on how
+// many newlines there are rather than on each one.
+__attribute__((target("avx2,bmi,popcnt"))) inline void flatten(uint64_t mask,uint32_t base,uint32_t*& out) {
+    uint32_t* o=out;
+    out+=_mm_popcnt_u64(mask);
+    for (;mask;o+=4) {
+        o[0]=base+_tzcnt_u64(mask);
+        mask=_blsr_u64(mask);
+        o[1]=base+_tzcnt_u64(mask);
+        mask=_blsr_u64(mask);
+        o[2]=base+_tzcnt_u64(mask);
+        mask=_blsr_u64(mask);
+        o[3]=base+_tzcnt_u64(mask);
+        mask=_blsr_u64(mask);
+    }
+}
+__attribute__((target("avx2,bmi,popcnt"))) inline uint64_t newline_mask(const char* p,__m256i needle) {
+    uint64_t lo=(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p),needle));
+    uint64_t hi=(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+32)),needle));
+    return lo|hi<<32;
+}
+__attribute__((target("avx2,bmi,popcnt"))) inline size_t newline_offsets(const char* p,size_t n,uint32_t* out) {
+    __m256i needle=_mm256_set1_epi8('\n');
+    uint32_t* o=out;
+    size_t i=0;
+    for (;n-i>=128;i+=128) {
+        __m256i any=_mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i)),needle),
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i+32)),needle)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i+64)),needle),
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p+i+96)),needle)));
+        if (_mm256_testz_si256(any,any)) continue;
+        flatten(newline_mask(p+i,needle),i,o);
+        flatten(newline_mask(p+i+64,needle),i+64,o);
+    }
+    if (n-i>=64) {
+        flatten(newline_mask(p+i,needle),i,o);
+        i+=64;
+    }
+    size_t count=o-out;
+    size_t rest=sse2::newline_offsets(p+i,n-i,out+count);
+    for (size_t k=count;k<count+rest;k++) out[k]+=i;
+    return count+rest;
+}
+}
+#endif
+
+inline Kernels pick() {
+    Kernels k={"scalar",scalar::count_byte,scalar::count_codepoints,scalar::newline_offsets};
+    const char* cap=getenv("FATE_SCAN");
+    if (cap&&!strcmp(cap,"scalar")) return k;
+#if SCAN_X86
+    k={"sse2",sse2::count_byte,sse2::count_codepoints,sse2::newline_offsets};
+    if (cap&&!strcmp(cap,"sse2")) return k;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")&&__builtin_cpu_supports("bmi")&&__builtin_cpu_supports("popcnt")) {
+        k={"avx2",avx2::count_byte,avx2::count_codepoints,avx2::newline_offsets};
+    }
+#endif
+    return k;
+}
+
+inline const Kernels& kernels() {
+    static const Kernels k=pick();
+    return k;
+}
+
+inline size_t count_byte(const char* p,size_t n,char c) {
+    return kernels().count_byte(p,n,c);
+}
+// Finding a byte is left to glibc, whose memchr and memrchr are picked per
+// CPU already and outrun the loops above. nullptr where there is no c.
+inline const char* find_byte(const char* p,size_t n,char c) {
+    return (const char*)memchr(p,c,n);
+}
+inline const char* find_byte_back(const char* p,size_t n,char c) {
+    return (const char*)memrchr(p,c,n);
+}
+inline size_t count_codepoints(const char* p,size_t n) {
+    return kernels().count_codepoints(p,n);
+}
+
+// Calls fn(size_t offset) for each '\n' in p[0, n), in order, a BLOCK of
+// offsets at a time.
+template<class Fn>
+void for_each_newline(const char* p,size_t n,Fn&& fn) {
+    auto offsets=kernels().newline_offsets;
+    uint32_t out[BLOCK+3];
+    for (size_t at=0;at<n;at+=BLOCK) {
+        size_t found=offsets(p+at,std::min(BLOCK,n-at),out);
+        for (size_t k=0;k<found;k++) fn(at+out[k]);
+    }
+}
+}
+#endif
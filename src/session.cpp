@@ -0,0 +1,271 @@
+#ifndef SESSION
+#define SESSION
+#include <SDL2/SDL_events.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Input sessions: the events Window acts on, timestamped, after a header
+// with the window size and the name and contents of the file being edited.
+// Everything after the 8-byte magic is LEB128 varints (signed values
+// zigzagged, text as length then bytes), and each event is stored as the
+// microseconds since the previous one (none within a batch Window took in
+// together), its type and just the fields Window reads, so a minute of
+// typing takes a few kilobytes.
+namespace session {
+const char MAGIC[8]={'F','A','T','E','S','E','S','1'};
+enum Kind { QUIT, KEY_DOWN, KEY_UP, TEXT, WHEEL, WINDOW };
+}
+
+class SessionWriter {
+    using clock = std::chrono::steady_clock;
+    FILE* out;
+    clock::time_point last=clock::now(),batch=last;
+    SessionWriter(FILE* out): out(out) {}
+    void put(uint64_t v) {
+        do {
+            fputc((v&0x7f)|(v>0x7f?0x80:0),out);
+            v>>=7;
+        } while (v);
+    }
+    void putSigned(int64_t v) {
+        put(((uint64_t)v<<1)^(uint64_t)(v>>63));
+    }
+    void putBytes(const char* p,size_t n) {
+        put(n);
+        fwrite(p,1,n,out);
+    }
+    void stamp(session::Kind kind) {
+        put(std::chrono::duration_cast<std::chrono::microseconds>(batch-last).count());
+        last=batch;
+        put(kind);
+    }
+public:
+    // nullptr if path can't be written. filename is read now, so the
+    // session replays against the text as it was when recording began.
+    static SessionWriter* create(const std::string& path,const std::string& filename,int width,int height) {
+        FILE* out=fopen(path.c_str(),"wb");
+        if (!out) return nullptr;
+        std::ifstream file(filename,std::ios::binary);
+        std::stringstream contents;
+        if (file) contents<<file.rdbuf();
+        std::string text=contents.str();
+        SessionWriter* w=new SessionWriter(out);
+        fwrite(session::MAGIC,1,sizeof(session::MAGIC),out);
+        w->put(width);
+        w->put(height);
+        w->putBytes(filename.data(),filename.size());
+        w->putBytes(text.data(),text.size());
+        w->last=w->batch=clock::now();
+        return w;
+    }
+    SessionWriter(const SessionWriter&)=delete;
+    SessionWriter& operator=(const SessionWriter&)=delete;
+    ~SessionWriter() {
+        fclose(out);
+    }
+    // Starts a batch of events, taken in together; they are written with
+    // the time of this call and replayed together.
+    void mark() {
+        batch=clock::now();
+    }
+    // Events Window ignores aren't written.
+    void write(const SDL_Event& e) {
+        switch (e.type) {
+            case SDL_QUIT:
+                stamp(session::QUIT);
+                break;
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                stamp(e.type==SDL_KEYDOWN?session::KEY_DOWN:session::KEY_UP);
+                put(e.key.keysym.scancode);
+                put((uint32_t)e.key.keysym.sym);
+                put(e.key.keysym.mod);
+                put(e.key.repeat);
+                break;
+            case SDL_TEXTINPUT:
+                stamp(session::TEXT);
+                putBytes(e.text.text,strlen(e.text.text));
+                break;
+            case SDL_MOUSEWHEEL:
+                stamp(session::WHEEL);
+                putSigned(e.wheel.x);
+                putSigned(e.wheel.y);
+                break;
+            case SDL_WINDOWEVENT:
+                stamp(session::WINDOW);
+                put(e.window.event);
+                putSigned(e.window.data1);
+                putSigned(e.window.data2);
+                break;
+        }
+    }
+};
+
+// Plays a session back on a clock of its own that starts at zero and only
+// moves when advanced: to real time as it passes, or straight to the next
+// event at maximum speed. Key repeats and the like follow this clock, so a
+// session replays the same edits at either speed.
+class SessionReader {
+    using clock = std::chrono::steady_clock;
+    FILE* in;
+    bool realTime;
+    clock::time_point start;
+    int64_t now=0,next=-1;
+    SDL_Event event;
+    int width=0,height=0;
+    std::string filename,text;
+    SessionReader(FILE* in,bool realTime): in(in),realTime(realTime) {}
+    bool get(uint64_t& v) {
+        v=0;
+        for (int shift=0;shift<64;shift+=7) {
+            int c=fgetc(in);
+            if (c==EOF) return false;
+            v|=(uint64_t)(c&0x7f)<<shift;
+            if (!(c&0x80)) return true;
+        }
+        return false;
+    }
+    bool getSigned(int64_t& v) {
+        uint64_t u;
+        if (!get(u)) return false;
+        v=(int64_t)(u>>1)^-(int64_t)(u&1);
+        return true;
+    }
+    bool getBytes(std::string& s) {
+        uint64_t n;
+        if (!get(n)) return false;
+        s.resize(n);
+        return fread(&s[0],1,n,in)==n;
+    }
+    // Reads the next event into event and its time into next; next is -1
+    // at the end of the session or at the first record that doesn't parse.
+    void read() {
+        uint64_t delta,kind,a,b,c,d;
+        int64_t x,y;
+        std::string s;
+        int64_t at=next<0?now:next;
+        next=-1;
+        if (!get(delta)||!get(kind)) return;
+        memset(&event,0,sizeof(event));
+        switch (kind) {
+            case session::QUIT:
+                event.type=SDL_QUIT;
+                break;
+            case session::KEY_DOWN:
+            case session::KEY_UP:
+                if (!get(a)||!get(b)||!get(c)||!get(d)) return;
+                event.type=kind==session::KEY_DOWN?SDL_KEYDOWN:SDL_KEYUP;
+                event.key.state=kind==session::KEY_DOWN?SDL_PRESSED:SDL_RELEASED;
+                event.key.keysym.scancode=(SDL_Scancode)a;
+                event.key.keysym.sym=(SDL_Keycode)b;
+                event.key.keysym.mod=c;
+                event.key.repeat=d;
+                break;
+            case session::TEXT:
+                if (!getBytes(s)||s.size()>=sizeof(event.text.text)) return;
+                event.type=SDL_TEXTINPUT;
+                memcpy(event.text.text,s.data(),s.size());
+                break;
+            case session::WHEEL:
+                if (!getSigned(x)||!getSigned(y)) return;
+                event.type=SDL_MOUSEWHEEL;
+                event.wheel.x=x;
+                event.wheel.y=y;
+                break;
+            case session::WINDOW:
+                if (!get(a)||!getSigned(x)||!getSigned(y)) return;
+                event.type=SDL_WINDOWEVENT;
+                event.window.event=a;
+                event.window.data1=x;
+                event.window.data2=y;
+                break;
+            default:
+                return;
+        }
+        event.common.timestamp=(at+delta)/1000;
+        next=at+delta;
+    }
+public:
+    // nullptr if path isn't a session. With realTime unset it plays back
+    // as fast as it is consumed.
+    static SessionReader* open(const std::string& path,bool realTime) {
+        FILE* in=fopen(path.c_str(),"rb");
+        if (!in) return nullptr;
+        SessionReader* r=new SessionReader(in,realTime);
+        char magic[sizeof(session::MAGIC)];
+        uint64_t w,h;
+        if (fread(magic,1,sizeof(magic),in)!=sizeof(magic)||memcmp(magic,session::MAGIC,sizeof(magic))!=0||
+            !r->get(w)||!r->get(h)||!r->getBytes(r->filename)||!r->getBytes(r->text)) {
+            delete r;
+            return nullptr;
+        }
+        r->width=w;
+        r->height=h;
+        r->start=clock::now();
+        r->read();
+        return r;
+    }
+    SessionReader(const SessionReader&)=delete;
+    SessionReader& operator=(const SessionReader&)=delete;
+    ~SessionReader() {
+        fclose(in);
+    }
+    int Width() const {
+        return width;
+    }
+    int Height() const {
+        return height;
+    }
+    // The file as recorded and its text at the start of the session.
+    const std::string& fileName() const {
+        return filename;
+    }
+    const std::string& fileText() const {
+        return text;
+    }
+    bool done() const {
+        return next<0;
+    }
+    // Session time in milliseconds, in place of SDL_GetTicks.
+    Uint32 ticks() const {
+        return now/1000;
+    }
+    // Moves the clock to the next event, or timeout ms ahead if that comes
+    // first (never, if negative). In real time it waits until then, a
+    // wait(ms) at a time; when one returns true there is something to see
+    // to first, and the clock stops where it is.
+    template<class Wait>
+    void advance(int timeout,Wait&& wait) {
+        int64_t to=next;
+        if (timeout>=0&&(to<0||now+timeout*1000LL<to)) to=now+timeout*1000LL;
+        if (to<now) return;
+        clock::time_point until=start+std::chrono::microseconds(to);
+        while (realTime) {
+            clock::duration left=until-clock::now();
+            if (left<std::chrono::milliseconds(1)) {
+                std::this_thread::sleep_until(until);
+                break;
+            }
+            if (wait((int)std::chrono::duration_cast<std::chrono::milliseconds>(left).count())) {
+                to=std::min<int64_t>(to,std::chrono::duration_cast<std::chrono::microseconds>(clock::now()-start).count());
+                break;
+            }
+        }
+        now=std::max(now,to);
+    }
+    // The next event if it is due by now.
+    bool poll(SDL_Event& e) {
+        if (next<0||next>now) return false;
+        e=event;
+        read();
+        return true;
+    }
+};
+#endif
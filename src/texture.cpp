@@ -10,53 +10,160 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL2_gfxPrimitives.h>
 #include <SDL2/SDL_video.h>
+#include <algorithm>
+#include <climits>
 #include <cstddef>
 #include <cstdlib>
+#include <initializer_list>
 #include <ostream>
 #include <string>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
 #include <ext/rope>
+#include "glyphatlas.cpp"
+#include "layout.cpp"
+#include "ropechunks.cpp"
+#include "trace.cpp"
 typedef __gnu_cxx::crope rope;
-inline std::string rope_substr(const rope& r, size_t start, size_t len) {
-    return r.substr(start, len).c_str();
-}
 
+// Everything up to flush only records, so a Texture can be drawn into on
+// one thread and flushed on the renderer's. SDL textures are made, and
+// ones given up by resize or reloadFont destroyed, by the next flush.
 class Texture {
     SDL_Texture* texture = nullptr;
+    SDL_Texture* spare = nullptr;
     SDL_Renderer* renderer = nullptr;
-    SDL_Color curcolor;
+    SDL_Color curcolor={0,0,0,255};
     std::vector<TTF_Font*> fonts;
+    std::vector<GlyphAtlas*> atlases,retired;
+    std::vector<FontMetrics> metrics;
+    std::unordered_map<std::string,int> fontPaths;
     int width,height;
-public:
-    Texture(SDL_Renderer* r,int width,int height): width(width),height(height),renderer(r) {
-        texture=SDL_CreateTexture(renderer,SDL_PIXELFORMAT_RGBA8888,SDL_TEXTUREACCESS_TARGET,width,height);
-        if (!texture) {
-            std::cerr<<"SDL_CreateTexture Error: "<<SDL_GetError()<<std::endl;
-        }
+    int allocWidth,allocHeight;
+    bool reallocate=true;
+    // Drawing is recorded and replayed by flush. Runs of rects or points in
+    // one color share a command and go out as one SDL_RenderFillRects,
+    // SDL_RenderDrawRects or SDL_RenderDrawPoints call; consecutive text
+    // shares one SDL_RenderGeometry per atlas page. Order is kept, so
+    // overlapping draws layer as they were issued.
+    struct Command {
+        enum Kind { CLEAR, MOVE, FILL_RECTS, RECTS, POINTS, LINE, CIRCLE, FILL_CIRCLE, ARC, POLY, FILL_POLY, GLYPHS };
+        Kind kind;
+        SDL_Color color;
+        int args[5];
+        int font;
+        size_t first,count;
+    };
+    std::vector<Command> commands;
+    std::vector<SDL_Rect> rects;
+    std::vector<SDL_Point> points;
+    std::vector<Sint16> polyX,polyY;
+    std::vector<size_t> marks;
+    // The command to add to: the last one when it is a run of the same
+    // kind and color, otherwise a new one.
+    Command& push(Command::Kind kind,std::initializer_list<int> args={}) {
+        bool run=kind==Command::FILL_RECTS||kind==Command::RECTS||kind==Command::POINTS;
+        if (run&&!commands.empty()) {
+            Command& last=commands.back();
+            SDL_Color k=last.color;
+            if (last.kind==kind&&k.r==curcolor.r&&k.g==curcolor.g&&k.b==curcolor.b&&k.a==curcolor.a) return last;
+        }
+        Command c{kind,curcolor,{0,0,0,0,0},-1,0,0};
+        std::copy(args.begin(),args.end(),c.args);
+        if (kind==Command::POINTS) c.first=points.size();
+        if (kind==Command::FILL_RECTS||kind==Command::RECTS) c.first=rects.size();
+        commands.push_back(c);
+        return commands.back();
+    }
+    // Forgets everything recorded, keeping the buffers' capacity.
+    void reset() {
+        commands.clear();
+        rects.clear();
+        points.clear();
+        polyX.clear();
+        polyY.clear();
+        marks.clear();
+        for (auto a:atlases) if (a) a->discard();
     }
+    // Measured once per font: every Latin-1 advance, and whether the face
+    // is fixed width with the printable ASCII range agreeing on one cell.
+    static FontMetrics measure(TTF_Font* font) {
+        FontMetrics m;
+        if (!font) return m;
+        m.lineHeight=TTF_FontLineSkip(font);
+        for (int c=0;c<256;c++) {
+            int minx,maxx,miny,maxy,advance;
+            if (TTF_GlyphMetrics(font,c,&minx,&maxx,&miny,&maxy,&advance)==0) m.prop.advances[c]=advance;
+        }
+        m.mono.cell=m.prop.advances['M'];
+        m.fixed=TTF_FontFaceIsFixedWidth(font)!=0;
+        for (int c=' ';c<127&&m.fixed;c++) m.fixed=m.prop.advances[c]==m.mono.cell;
+        return m;
+    }
+public:
+    Texture(SDL_Renderer* r,int width,int height): renderer(r),width(width),height(height),allocWidth(width),allocHeight(height) {}
+    // On the renderer's thread, like flush.
     ~Texture() {
+        for (auto i:atlases) {
+            delete i;
+        }
+        for (auto i:retired) {
+            delete i;
+        }
         for (auto i:fonts) {
-            TTF_CloseFont(i);
+            if (i) TTF_CloseFont(i);
         }
         if (texture) SDL_DestroyTexture(texture);
+        if (spare) SDL_DestroyTexture(spare);
     }
     SDL_Texture* getTexture() {
         return texture;
     }
     int loadFont(std::string fontPath,int fontSize) {
-        fonts.push_back(TTF_OpenFont(fontPath.c_str(),fontSize));
+        TRACE_SCOPE("Texture::loadFont");
+        TTF_Font* font=TTF_OpenFont(fontPath.c_str(),fontSize);
+        fonts.push_back(font);
+        atlases.push_back(font?new GlyphAtlas(renderer,font):nullptr);
+        metrics.push_back(measure(font));
         return fonts.size()-1;
     }
     int reloadFont(int i,std::string fontPath,int fontSize) {
         if (i>=fonts.size()) {
             return loadFont(fontPath,fontSize);
         } else {
-            TTF_CloseFont(fonts[i]);
+            TRACE_SCOPE("Texture::reloadFont");
+            if (atlases[i]) retired.push_back(atlases[i]);
+            if (fonts[i]) TTF_CloseFont(fonts[i]);
             fonts[i]=TTF_OpenFont(fontPath.c_str(),fontSize);
+            atlases[i]=fonts[i]?new GlyphAtlas(renderer,fonts[i]):nullptr;
+            metrics[i]=measure(fonts[i]);
             return i;
         }
     }
+    // Fonts requested by path are opened once and kept, so their glyphs
+    // stay in the atlas between calls.
+    int fontFor(const std::string& fontPath,int fontSize) {
+        std::string key=fontPath+":"+std::to_string(fontSize);
+        auto it=fontPaths.find(key);
+        if (it!=fontPaths.end()) return it->second;
+        int i=loadFont(fontPath,fontSize);
+        if (!fonts[i]) i=-1;
+        fontPaths[key]=i;
+        return i;
+    }
+    // Glyph cache lookups over every font, since the fonts were loaded.
+    void glyphStats(size_t& hits,size_t& misses) {
+        hits=misses=0;
+        for (auto a:atlases) {
+            if (!a) continue;
+            hits+=a->hits();
+            misses+=a->misses();
+        }
+    }
+    const FontMetrics& getMetrics(int i) {
+        return metrics[i];
+    }
     TTF_Font* getFont(int i) {
         if (i>=fonts.size()) return nullptr;
         return fonts[i];
@@ -67,549 +174,324 @@ public:
     int Height() {
         return height;
     }
-    void resize(int newWidth,int newHeight) {
-        if (texture) SDL_DestroyTexture(texture);
-        if (!renderer) return;
-        texture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, newWidth, newHeight);
+    // Sets the drawable size, which may be smaller than the texture. It is
+    // only reallocated when it has to grow, then by at least a quarter in
+    // each direction so a drag-resize reallocates a handful of times, or
+    // when it would be more than four times the size needed. Returns
+    // whether it will be, in which case its contents are gone.
+    bool resize(int newWidth,int newHeight) {
         width=newWidth;
         height=newHeight;
+        bool fits=width<=allocWidth&&height<=allocHeight;
+        bool wasteful=(long)width*height*4<(long)allocWidth*allocHeight;
+        if (!reallocate&&fits&&!wasteful) return false;
+        reset();
+        reallocate=true;
+        if (fits) {
+            allocWidth=width;
+            allocHeight=height;
+        } else {
+            allocWidth=std::max(width,allocWidth+allocWidth/4);
+            allocHeight=std::max(height,allocHeight+allocHeight/4);
+        }
+        return true;
     }
     void setColor(SDL_Color c) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_SetRenderDrawColor(renderer,c.r,c.g,c.b,c.a);
         curcolor=c;
-        SDL_SetRenderTarget(renderer,NULL);
     }
     void setColor(Uint8 r,Uint8 g,Uint8 b,Uint8 a) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_SetRenderDrawColor(renderer,r,g,b,a);
         curcolor={r,g,b,a};
-        SDL_SetRenderTarget(renderer,NULL);
     }
     void drawPoint(int x,int y) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_RenderDrawPoint(renderer,x,y);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::POINTS).count++;
+        points.push_back({x,y});
     }
     void drawLine(int x1,int y1,int x2,int y2) {
-        SDL_SetRenderTarget(renderer,texture);
-        aalineRGBA(renderer,x1,y1,x2,y2,curcolor.r,curcolor.g,curcolor.b,curcolor.a);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::LINE,{x1,y1,x2,y2});
     }
     void drawRect(int x,int y,int w,int h) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_Rect rect = {x,y,w,h};
-        SDL_RenderDrawRect(renderer,&rect);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::RECTS).count++;
+        rects.push_back({x,y,w,h});
     }
     void fillRect(int x,int y,int w,int h) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_Rect rect = {x,y,w,h};
-        SDL_RenderFillRect(renderer,&rect);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::FILL_RECTS).count++;
+        rects.push_back({x,y,w,h});
     }
     void fillRoundedRect(int x, int y, int w, int h, int r) {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_Rect rect = {x + r, y, w - 2 * r, h};
-        SDL_RenderFillRect(renderer, &rect);
-        SDL_Rect rect2 = {x, y + r, r, h - 2 * r}; 
-        SDL_RenderFillRect(renderer, &rect2);
-        SDL_Rect rect3 = {x + w - r, y + r, r, h - 2 * r}; 
-        SDL_RenderFillRect(renderer, &rect3);
+        fillRect(x + r, y, w - 2 * r, h);
+        fillRect(x, y + r, r, h - 2 * r);
+        fillRect(x + w - r, y + r, r, h - 2 * r);
         fillCircle(x + r, y + r, r); 
         fillCircle(x + w - r - 1, y + r, r); 
         fillCircle(x + r, y + h - r - 1, r); 
         fillCircle(x + w - r - 1, y + h - r - 1, r); 
-        SDL_SetRenderTarget(renderer,NULL);
     }
     void drawCircle(int centerX,int centerY,int radius) {
-        SDL_SetRenderTarget(renderer,texture);
-        circleRGBA(renderer,centerX,centerY,radius,curcolor.r,curcolor.g,curcolor.b,curcolor.a);
+        push(Command::CIRCLE,{centerX,centerY,radius});
     }
     void fillCircle(int centerX,int centerY,int radius) {
-        SDL_SetRenderTarget(renderer,texture);
-        filledCircleRGBA(renderer,centerX,centerY,radius,curcolor.r,curcolor.g,curcolor.b,curcolor.a);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::FILL_CIRCLE,{centerX,centerY,radius});
     }
     void drawArc(int x,int y,int radius,float startAngle,float endAngle) {
-        SDL_SetRenderTarget(renderer,texture);
-        float startRad = startAngle * (M_PI / 180.0f);
-        float endRad = endAngle * (M_PI / 180.0f);
-        arcRGBA(renderer,x,y,radius,startAngle,endAngle,curcolor.r,curcolor.g,curcolor.b,curcolor.a);
-        SDL_SetRenderTarget(renderer,NULL);
+        push(Command::ARC,{x,y,radius,(int)startAngle,(int)endAngle});
     }
     void drawPoly(const std::vector<Sint16>& px, const std::vector<Sint16>& py) {
-        SDL_SetRenderTarget(renderer,texture);
-        int num_points = std::min(px.size(), py.size());
-        std::vector<Sint16> x(num_points);
-        std::vector<Sint16> y(num_points);
-        for (int i = 0; i < num_points; i++) {
-            x[i] = px[i];
-            y[i] = py[i];
-        }
-        polygonRGBA(renderer, x.data(), y.data(), num_points, curcolor.r, curcolor.g, curcolor.b, curcolor.a);
-        SDL_SetRenderTarget(renderer,NULL);
+        Command& c = push(Command::POLY);
+        c.first = polyX.size();
+        c.count = std::min(px.size(), py.size());
+        polyX.insert(polyX.end(), px.begin(), px.begin() + c.count);
+        polyY.insert(polyY.end(), py.begin(), py.begin() + c.count);
     }
     void fillPoly(const std::vector<Sint16>& px, const std::vector<Sint16>& py) {
-        SDL_SetRenderTarget(renderer,texture);
-        int num_points = std::min(px.size(), py.size());
-        std::vector<Sint16> x(num_points);
-        std::vector<Sint16> y(num_points);
-        for (int i = 0; i < num_points; i++) {
-            x[i] = px[i];
-            y[i] = py[i];
-        }
-        filledPolygonRGBA(renderer, x.data(), y.data(), num_points, curcolor.r, curcolor.g, curcolor.b, curcolor.a);
-        SDL_SetRenderTarget(renderer,NULL);
+        Command& c = push(Command::FILL_POLY);
+        c.first = polyX.size();
+        c.count = std::min(px.size(), py.size());
+        polyX.insert(polyX.end(), px.begin(), px.begin() + c.count);
+        polyY.insert(polyY.end(), py.begin(), py.begin() + c.count);
     }
-    void drawText(std::string text, int x, int y, int f, int maxWidth, SDL_Color color) {
-        SDL_SetRenderTarget(renderer,texture);
-        TTF_Font* font = fonts[f];
-        if (!font) {
+    // Queues one row of glyphs in font f. Rows queued back to back share
+    // one command, however many there are.
+    void queueText(int f, const char* text, size_t len, int x, int y, SDL_Color color) {
+        atlases[f]->queue(text, len, x, y, color);
+        bool extend = !commands.empty() && commands.back().kind == Command::GLYPHS && commands.back().font == f;
+        Command& c = extend ? commands.back() : push(Command::GLYPHS);
+        c.font = f;
+        c.first = marks.size() - (extend ? c.count : 0);
+        marks.resize(c.first);
+        atlases[f]->mark(marks);
+        c.count = marks.size() - c.first;
+    }
+    // Wraps and draws the logical lines nextLine produces, one per call,
+    // until it runs out or maxHeight is filled. Every multi-line drawText
+    // goes through here.
+    template<class NextLine>
+    void drawLines(NextLine&& nextLine, int x, int y, int f, int maxWidth, int maxHeight, SDL_Color color) {
+        if (!getFont(f)) {
             std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
             return;
         }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        for (size_t i = 0; i < text.size(); ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                return;
-            }
-            if (textWidth > maxWidth) {
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty()) {
-            lines.push_back(currentLine);
-        }
-        if (!text.empty() && text.back() == '\n') {
-            lines.push_back("");
-        }
-        int lineHeight = TTF_FontLineSkip(font);
+        withMetrics(metrics[f], [&](const auto& m) {
+            drawLines(nextLine, m, x, y, f, maxWidth, maxHeight, color);
+        });
+    }
+    template<class NextLine, class Metrics>
+    void drawLines(NextLine& nextLine, const Metrics& m, int x, int y, int f, int maxWidth, int maxHeight, SDL_Color color) {
+        int lineHeight = metrics[f].lineHeight;
+        std::string line;
+        std::vector<size_t> breaks;
         int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
+        while (maxHeight - lineHeight >= yOffset && nextLine(line)) {
+            wrapLine(m, line.data(), line.size(), maxWidth, breaks);
+            size_t rowStart = 0;
+            for (size_t i = 0; i <= breaks.size() && maxHeight - lineHeight >= yOffset; i++) {
+                size_t rowEnd = i < breaks.size() ? breaks[i] : line.size();
+                queueText(f, line.data() + rowStart, rowEnd - rowStart, x, y + yOffset, color);
+                yOffset += lineHeight;
+                rowStart = rowEnd;
             }
-            yOffset += lineHeight;
         }
-        SDL_SetRenderTarget(renderer,NULL);
+    }
+    void drawText(std::string text, int x, int y, int f, int maxWidth, SDL_Color color) {
+        drawText(text, x, y, f, maxWidth, INT_MAX, color);
     }
     void drawText(std::string text, int x, int y, int f, int maxWidth, int maxHeight, SDL_Color color) {
-        SDL_SetRenderTarget(renderer,texture);
-        TTF_Font* font = fonts[f];
-        if (!font) {
-            std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
-            return;
-        }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        int totalHeight = 0;
-        int lineHeight = TTF_FontLineSkip(font);
-        for (size_t i = 0; i < text.size(); ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                return;
-            }
-            if (textWidth > maxWidth) {
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty() && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back(currentLine);
-        }
-        if (!text.empty() && text.back() == '\n' && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back("");
-        }
-        int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
-            }
-            yOffset += lineHeight;
-            if (y + yOffset + lineHeight > y + maxHeight) break;
-        }
-        SDL_SetRenderTarget(renderer,NULL);
+        size_t pos = 0;
+        auto nextLine = [&](std::string& line) {
+            if (pos > text.size()) return false;
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) nl = text.size();
+            line.assign(text, pos, nl - pos);
+            pos = nl + 1;
+            return true;
+        };
+        drawLines(nextLine, x, y, f, maxWidth, maxHeight, color);
     }
     void drawText(std::string text, int x, int y, const std::string& fontPath, int fontSize, int maxWidth, int maxHeight, SDL_Color color) {
-        SDL_SetRenderTarget(renderer,texture);
-        TTF_Font* font = TTF_OpenFont(fontPath.c_str(), fontSize);
-        if (!font) {
+        int f = fontFor(fontPath, fontSize);
+        if (f < 0) {
             std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
             return;
         }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        int totalHeight = 0;
-        int lineHeight = TTF_FontLineSkip(font);
-        for (size_t i = 0; i < text.size(); ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                TTF_CloseFont(font);
-                return;
-            }
-            if (textWidth > maxWidth) {
-        SDL_SetRenderTarget(renderer,texture);
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty() && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back(currentLine);
-        }
-        if (!text.empty() && text.back() == '\n' && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back("");
-        }
-        int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
-            }
-            yOffset += lineHeight;
-            if (y + yOffset + lineHeight > y + maxHeight) break;
-        }
-        TTF_CloseFont(font);
-        SDL_SetRenderTarget(renderer,NULL);
+        drawText(text, x, y, f, maxWidth, maxHeight, color);
     }
     void drawText(std::string text, int x, int y, const std::string& fontPath, int fontSize, int maxWidth, SDL_Color color) {
-        SDL_SetRenderTarget(renderer,texture);
-        TTF_Font* font = TTF_OpenFont(fontPath.c_str(), fontSize);
-        if (!font) {
+        int f = fontFor(fontPath, fontSize);
+        if (f < 0) {
             std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
             return;
         }
-        int textWidth = 0, textHeight = 0;
-        if (TTF_SizeText(font, text.c_str(), &textWidth, &textHeight) != 0) {
-            std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-            TTF_CloseFont(font);
-            return;
-        }
-        while (textWidth > maxWidth && !text.empty()) {
-            text.pop_back();
-            TTF_SizeText(font, text.c_str(), &textWidth, &textHeight);
+        size_t len = 0;
+        int textWidth = 0;
+        const Proportional& m = metrics[f].prop;
+        while (len < text.size() && textWidth + m.advance(text[len]) <= maxWidth) {
+            textWidth += m.advance(text[len++]);
         }
-        if (!text.empty()) {
-            SDL_Surface* surface = TTF_RenderText_Blended(font, text.c_str(), color);
-            if (surface) {;
-                SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                SDL_FreeSurface(surface);
-                if (texture) {
-                    SDL_Rect destRect = {x, y, 0, 0};
-                    SDL_QueryTexture(texture, NULL, NULL, &destRect.w, &destRect.h);
-                    SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                    SDL_DestroyTexture(texture);
-                }
-            }
-        }
-        TTF_CloseFont(font);
-        SDL_SetRenderTarget(renderer,NULL);
+        queueText(f, text.data(), len, x, y, color);
     }
 
     void drawText(const rope& text, int x, int y, int f, int maxWidth, SDL_Color color) {
-        SDL_SetRenderTarget(renderer, texture);
-        TTF_Font* font = fonts[f];
-        if (!font) {
-            std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
-            return;
-        }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        size_t N = text.size();
-        for (size_t i = 0; i < N; ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                return;
-            }
-            if (textWidth > maxWidth) {
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty()) {
-            lines.push_back(currentLine);
-        }
-        if (N > 0 && text[N-1] == '\n') {
-            lines.push_back("");
-        }
-        int lineHeight = TTF_FontLineSkip(font);
-        int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
-            }
-            yOffset += lineHeight;
-        }
-        SDL_SetRenderTarget(renderer, NULL);
+        drawText(text, 0, x, y, f, maxWidth, INT_MAX, color);
     }
     
     // 2. drawText with maxWidth and maxHeight
     void drawText(const rope& text, int x, int y, int f, int maxWidth, int maxHeight, SDL_Color color) {
-        SDL_SetRenderTarget(renderer, texture);
-        TTF_Font* font = fonts[f];
-        if (!font) {
-            std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
-            return;
-        }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        int totalHeight = 0;
-        int lineHeight = TTF_FontLineSkip(font);
-        size_t N = text.size();
-        for (size_t i = 0; i < N; ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                return;
-            }
-            if (textWidth > maxWidth) {
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty() && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back(currentLine);
-        }
-        if (N > 0 && text[N-1] == '\n' && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back("");
-        }
-        int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
-            }
-            yOffset += lineHeight;
-            if (y + yOffset + lineHeight > y + maxHeight) break;
-        }
-        SDL_SetRenderTarget(renderer, NULL);
+        drawText(text, 0, x, y, f, maxWidth, maxHeight, color);
+    }
+
+    // 2b. same, laying out only from offset start until maxHeight is filled
+    void drawText(const rope& text, size_t start, int x, int y, int f, int maxWidth, int maxHeight, SDL_Color color) {
+        size_t pos = start, size = text.size();
+        bool done = false;
+        auto nextLine = [&](std::string& line) {
+            if (done) return false;
+            line.clear();
+            bool newline = !for_each_chunk(text, pos, size, [&](const char* p, size_t n) {
+                const char* nl = scan::find_byte(p, n, '\n');
+                size_t take = nl ? nl - p : n;
+                line.append(p, take);
+                pos += take;
+                return !nl;
+            });
+            if (newline) pos++;
+            else done = true;
+            return true;
+        };
+        drawLines(nextLine, x, y, f, maxWidth, maxHeight, color);
     }
     
     // 3. drawText with font path, font size, maxWidth, maxHeight
     void drawText(const rope& text, int x, int y, const std::string& fontPath, int fontSize, int maxWidth, int maxHeight, SDL_Color color) {
-        SDL_SetRenderTarget(renderer, texture);
-        TTF_Font* font = TTF_OpenFont(fontPath.c_str(), fontSize);
-        if (!font) {
+        int f = fontFor(fontPath, fontSize);
+        if (f < 0) {
             std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
             return;
         }
-        std::vector<std::string> lines;
-        std::string currentLine;
-        int totalHeight = 0;
-        int lineHeight = TTF_FontLineSkip(font);
-        size_t N = text.size();
-        for (size_t i = 0; i < N; ++i) {
-            char c = text[i];
-            if (c == '\n') {
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine.clear();
-                continue;
-            }
-            currentLine += c;
-            int textWidth = 0, textHeight = 0;
-            if (TTF_SizeText(font, currentLine.c_str(), &textWidth, &textHeight) != 0) {
-                std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-                TTF_CloseFont(font);
-                return;
-            }
-            if (textWidth > maxWidth) {
-                currentLine.pop_back();
-                lines.push_back(currentLine);
-                totalHeight += lineHeight;
-                if (totalHeight + lineHeight > maxHeight) break;
-                currentLine = c;
-            }
-        }
-        if (!currentLine.empty() && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back(currentLine);
-        }
-        if (N > 0 && text[N-1] == '\n' && totalHeight + lineHeight <= maxHeight) {
-            lines.push_back("");
-        }
-        int yOffset = 0;
-        for (const std::string& line : lines) {
-            if (!line.empty()) {
-                SDL_Surface* surface = TTF_RenderText_Blended(font, line.c_str(), color);
-                if (surface) {
-                    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                    SDL_FreeSurface(surface);
-                    if (texture) {
-                        int textWidth = 0, textHeight = 0;
-                        SDL_QueryTexture(texture, NULL, NULL, &textWidth, &textHeight);
-                        SDL_Rect destRect = {x, y + yOffset, textWidth, textHeight};
-                        SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                        SDL_DestroyTexture(texture);
-                    }
-                }
-            }
-            yOffset += lineHeight;
-            if (y + yOffset + lineHeight > y + maxHeight) break;
-        }
-        TTF_CloseFont(font);
-        SDL_SetRenderTarget(renderer, NULL);
+        drawText(text, x, y, f, maxWidth, maxHeight, color);
     }
     
     // 4. drawText with font path, font size, maxWidth
     void drawText(const rope& text, int x, int y, const std::string& fontPath, int fontSize, int maxWidth, SDL_Color color) {
-        SDL_SetRenderTarget(renderer, texture);
-        TTF_Font* font = TTF_OpenFont(fontPath.c_str(), fontSize);
-        if (!font) {
+        int f = fontFor(fontPath, fontSize);
+        if (f < 0) {
             std::cerr << "TTF_OpenFont Error: " << TTF_GetError() << std::endl;
             return;
         }
-        // For this function, we need to flatten the rope for TTF_SizeText.
-        // For very large ropes, consider rendering in chunks/lines for efficiency.
-        std::string s = text.c_str();
-        int textWidth = 0, textHeight = 0;
-        if (TTF_SizeText(font, s.c_str(), &textWidth, &textHeight) != 0) {
-            std::cerr << "TTF_SizeText Error: " << TTF_GetError() << std::endl;
-            TTF_CloseFont(font);
-            return;
-        }
-        while (textWidth > maxWidth && !s.empty()) {
-            s.pop_back();
-            TTF_SizeText(font, s.c_str(), &textWidth, &textHeight);
-        }
-        if (!s.empty()) {
-            SDL_Surface* surface = TTF_RenderText_Blended(font, s.c_str(), color);
-            if (surface) {
-                SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                SDL_FreeSurface(surface);
-                if (texture) {
-                    SDL_Rect destRect = {x, y, 0, 0};
-                    SDL_QueryTexture(texture, NULL, NULL, &destRect.w, &destRect.h);
-                    SDL_RenderCopy(renderer, texture, NULL, &destRect);
-                    SDL_DestroyTexture(texture);
+        std::string s;
+        int textWidth = 0;
+        const Proportional& m = metrics[f].prop;
+        for_each_chunk(text, 0, text.size(), [&](const char* p, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                int advance = m.advance(p[i]);
+                if (textWidth + advance > maxWidth) {
+                    s.append(p, i);
+                    return false;
                 }
+                textWidth += advance;
             }
-        }
-        TTF_CloseFont(font);
-        SDL_SetRenderTarget(renderer, NULL);
+            s.append(p, n);
+            return true;
+        });
+        queueText(f, s.data(), s.size(), x, y, color);
     }
+    // Copies the h pixel high band at srcY of what has been drawn so far,
+    // earlier frames included, to dstY. A run of moves builds a new image
+    // out of bands of the old one: it is drawn into a second texture and
+    // the two are swapped, since a texture can't be copied onto itself.
+    // Anything no band covers has to be drawn over afterwards.
+    void move(int srcY,int dstY,int h) {
+        push(Command::MOVE,{srcY,dstY,h});
+    }
+    // A clear covers everything recorded before it, so that is dropped.
     void clear() {
-        SDL_SetRenderTarget(renderer,texture);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderTarget(renderer,NULL);
+        clear(curcolor);
     }
     void clear(SDL_Color c) {
+        reset();
+        push(Command::CLEAR).color = c;
+    }
+    // Replays the recorded commands into the texture under one target
+    // bind. Window::drawTexture calls this before copying the texture.
+    void flush() {
+        for (auto i:retired) {
+            delete i;
+        }
+        retired.clear();
+        if (reallocate&&renderer) {
+            if (spare) SDL_DestroyTexture(spare);
+            spare=nullptr;
+            if (texture) SDL_DestroyTexture(texture);
+            TRACE_SCOPE("SDL_CreateTexture");
+            texture=SDL_CreateTexture(renderer,SDL_PIXELFORMAT_RGBA8888,SDL_TEXTUREACCESS_TARGET,allocWidth,allocHeight);
+            if (!texture) {
+                std::cerr<<"SDL_CreateTexture Error: "<<SDL_GetError()<<std::endl;
+            }
+            reallocate=!texture;
+        }
+        if (commands.empty()) return;
         SDL_SetRenderTarget(renderer,texture);
-        SDL_SetRenderDrawColor(renderer,c.r,c.g,c.b,c.a);
-        SDL_RenderClear(renderer);
+        bool moving=false;
+        for (const Command& c:commands) {
+            SDL_Color k=c.color;
+            const int* v=c.args;
+            if (moving&&c.kind!=Command::MOVE) {
+                std::swap(texture,spare);
+                moving=false;
+            }
+            switch (c.kind) {
+                case Command::CLEAR:
+                    SDL_SetRenderDrawColor(renderer,k.r,k.g,k.b,k.a);
+                    SDL_RenderClear(renderer);
+                    break;
+                case Command::MOVE: {
+                    if (!spare) {
+                        TRACE_SCOPE("SDL_CreateTexture");
+                        spare=SDL_CreateTexture(renderer,SDL_PIXELFORMAT_RGBA8888,SDL_TEXTUREACCESS_TARGET,allocWidth,allocHeight);
+                    }
+                    if (!spare) break;
+                    if (!moving) SDL_SetRenderTarget(renderer,spare);
+                    moving=true;
+                    SDL_Rect src={0,v[0],width,v[2]},dst={0,v[1],width,v[2]};
+                    SDL_RenderCopy(renderer,texture,&src,&dst);
+                    break;
+                }
+                case Command::FILL_RECTS:
+                    SDL_SetRenderDrawColor(renderer,k.r,k.g,k.b,k.a);
+                    SDL_RenderFillRects(renderer,rects.data()+c.first,c.count);
+                    break;
+                case Command::RECTS:
+                    SDL_SetRenderDrawColor(renderer,k.r,k.g,k.b,k.a);
+                    SDL_RenderDrawRects(renderer,rects.data()+c.first,c.count);
+                    break;
+                case Command::POINTS:
+                    SDL_SetRenderDrawColor(renderer,k.r,k.g,k.b,k.a);
+                    SDL_RenderDrawPoints(renderer,points.data()+c.first,c.count);
+                    break;
+                case Command::LINE:
+                    aalineRGBA(renderer,v[0],v[1],v[2],v[3],k.r,k.g,k.b,k.a);
+                    break;
+                case Command::CIRCLE:
+                    circleRGBA(renderer,v[0],v[1],v[2],k.r,k.g,k.b,k.a);
+                    break;
+                case Command::FILL_CIRCLE:
+                    filledCircleRGBA(renderer,v[0],v[1],v[2],k.r,k.g,k.b,k.a);
+                    break;
+                case Command::ARC:
+                    arcRGBA(renderer,v[0],v[1],v[2],v[3],v[4],k.r,k.g,k.b,k.a);
+                    break;
+                case Command::POLY:
+                    polygonRGBA(renderer,polyX.data()+c.first,polyY.data()+c.first,c.count,k.r,k.g,k.b,k.a);
+                    break;
+                case Command::FILL_POLY:
+                    filledPolygonRGBA(renderer,polyX.data()+c.first,polyY.data()+c.first,c.count,k.r,k.g,k.b,k.a);
+                    break;
+                case Command::GLYPHS:
+                    atlases[c.font]->submit(marks.data()+c.first,c.count);
+                    break;
+            }
+        }
+        if (moving) std::swap(texture,spare);
         SDL_SetRenderTarget(renderer,NULL);
+        reset();
     }
 };
 #endif
@@ -0,0 +1,381 @@
+#ifndef TEXT_VIEW
+#define TEXT_VIEW
+#include "drawing.cpp"
+#include "document.cpp"
+#include <SDL2/SDL_render.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <vector>
+// The drawing half of a CodingWindow. It lays out and records into its
+// texture on the layout thread, only seeing the buffer through the
+// snapshots it is handed, and is drawn, created and destroyed on the
+// window's thread while the layout thread waits.
+class TextView {
+    Window* window;
+    int fontSize,fontIndex;
+    std::string fontPath;
+    int pixelFontSize;
+    Document doc;
+    Texture t;
+    SDL_Color bg={35,33,54,255};
+    SDL_Color fg={250,244,237,255};
+    SDL_Color selectionColor={68,64,103,255};
+    size_t topLine=0;
+    std::pair<int,int> lastCursor={-1,-1};
+    static const Uint32 BLINK_MS=530;
+    Uint32 blinkStart=0;
+    bool cursorVisible=true;
+    bool dirty=true;
+    // Set when nothing in the texture can be trusted, e.g. before the
+    // first frame.
+    bool damaged=true;
+    TextLayout layout;
+    // The texture keeps OVERSCAN views' worth of rows above and below the
+    // visible ones, so scrolling within it only moves the source rect.
+    // Otherwise every frame lays the rows out again and keeps each one
+    // whose pixels it already has somewhere in the texture, moving it into
+    // place if need be; only edited, scrolled in or redecorated rows are
+    // rasterized.
+    static constexpr float OVERSCAN=0.5f;
+    int viewWidth,viewHeight;
+    int paintedHeight=0;
+    // The window's size in points and in pixels and the wheel scrolling,
+    // as of the snapshots seen so far.
+    int pointWidth,pointHeight;
+    int pixelWidth,pixelHeight;
+    int scrollY=0;
+    static const size_t NONE=(size_t)-1;
+    // One wrapped row of the texture: columns [begin, end) of a line, the
+    // selected columns and the cursor column (NONE if absent) painted on
+    // it, and its text at lineTexts[text] while it is being rasterized.
+    // Edits mark the rows of the lines they touch invalid.
+    struct Row {
+        size_t line,begin,end;
+        bool last;
+        size_t selBegin=0,selEnd=0,cursor=NONE;
+        bool valid=true;
+        size_t text=0;
+        bool operator<(const Row& o) const {
+            return line<o.line||(line==o.line&&begin<o.begin);
+        }
+        bool samePixels(const Row& o) const {
+            return valid&&o.valid&&line==o.line&&begin==o.begin&&end==o.end&&last==o.last&&
+                selBegin==o.selBegin&&selEnd==o.selEnd&&cursor==o.cursor;
+        }
+    };
+    std::vector<Row> rows,next;
+    std::vector<char> stale;
+    size_t viewRow=0;
+    std::vector<std::string> lineTexts;
+    std::string lineBuf;
+    template<class Metrics>
+    const std::vector<size_t>& breaksOf(size_t line, const Metrics& m) {
+        auto text = [&] { doc.lineText(line, lineBuf); return std::string_view(lineBuf); };
+        return layout.breaks(line, text, m);
+    }
+    int visibleLines() {
+        int lineHeight = t.getMetrics(fontIndex).lineHeight;
+        return lineHeight > 0 ? viewHeight / lineHeight : 1;
+    }
+    // Scrolls down until the cursor's own wrapped row fits, since wrapped
+    // lines above it can push it off screen.
+    template<class Metrics>
+    void follow(const Metrics& m, long& top, std::pair<int,int> cursor, long rows) {
+        const std::vector<size_t>& breaks = breaksOf(cursor.second, m);
+        long used = std::upper_bound(breaks.begin(), breaks.end(), (size_t)cursor.first) - breaks.begin() + 1;
+        for (long line = top; line < cursor.second; line++) used += breaksOf(line, m).size() + 1;
+        while (used > rows && top < cursor.second) used -= breaksOf(top++, m).size() + 1;
+    }
+    // Wheel scrolling moves the viewport freely; moving the cursor brings it
+    // back into view.
+    void scroll() {
+        long top = (long)topLine - (long)scrollY * 3;
+        scrollY = 0;
+        auto cursor = doc.mousePos();
+        if (cursor != lastCursor) {
+            lastCursor = cursor;
+            long rows = visibleLines();
+            if (cursor.second < top) top = cursor.second;
+            if (cursor.second >= top + rows) top = cursor.second - rows + 1;
+            layout.setWidth(viewWidth);
+            withMetrics(t.getMetrics(fontIndex), [&](const auto& m) { follow(m, top, cursor, rows); });
+        }
+        long last = (long)doc.lineCount() - 1;
+        if (top > last) top = last;
+        if (top < 0) top = 0;
+        if ((size_t)top != topLine) dirty = true;
+        topLine = top;
+    }
+    // A headless window's cursor stays on, so its frames depend only on
+    // the input.
+    void blink() {
+        if (window->isHeadless()) return;
+        bool visible = ((SDL_GetTicks() - blinkStart) / BLINK_MS) % 2 == 0;
+        if (visible != cursorVisible) dirty = true;
+        cursorVisible = visible;
+    }
+    template<class Metrics>
+    void layoutRows(const Metrics& m, size_t first, size_t capacity) {
+        next.clear();
+        for (size_t line = first; line < doc.lineCount() && next.size() < capacity; line++) {
+            const std::vector<size_t>& breaks = breaksOf(line, m);
+            size_t len = doc.lineLength(line);
+            for (size_t i = 0; i <= breaks.size() && next.size() < capacity; i++) {
+                Row row;
+                row.line = line;
+                row.begin = i ? breaks[i - 1] : 0;
+                row.end = i < breaks.size() ? breaks[i] : len;
+                row.last = i == breaks.size();
+                next.push_back(row);
+            }
+        }
+    }
+    // Row of next where a line starts, -1 if it isn't laid out.
+    long rowOf(size_t line) {
+        Row key;
+        key.line = line;
+        key.begin = 0;
+        auto it = std::lower_bound(next.begin(), next.end(), key);
+        return it != next.end() && it->line == line ? it - next.begin() : -1;
+    }
+    void decorate() {
+        auto sel = doc.selection();
+        auto from = doc.position(sel.first), to = doc.position(sel.second);
+        auto mouse = doc.mousePos();
+        for (Row& row : next) {
+            size_t end = row.last ? row.end + 1 : row.end;
+            if (sel.first != sel.second && row.line >= from.second && row.line <= to.second) {
+                row.selBegin = std::max(row.begin, row.line == from.second ? from.first : 0);
+                row.selEnd = std::min(end, row.line == to.second ? to.first : end);
+                if (row.selBegin >= row.selEnd) row.selBegin = row.selEnd = 0;
+            }
+            if (cursorVisible && row.line == (size_t)mouse.second && (size_t)mouse.first >= row.begin && (size_t)mouse.first < end) {
+                row.cursor = mouse.first;
+            }
+        }
+    }
+    // Renumbers the painted rows after an edit; rows of the lines it
+    // replaced no longer match what the buffer holds.
+    void apply(const LineEdit& e) {
+        for (Row& row : rows) {
+            if (row.line >= e.first + e.removed) {
+                row.line = row.line - e.removed + e.inserted;
+            } else if (row.line >= e.first) {
+                row.valid = false;
+            }
+        }
+    }
+    // Marks which rows of next have to be rasterized, and moves the ones
+    // the texture already holds into place. Matching rows are found by
+    // walking both sorted layouts together; each run of them that moved by
+    // the same amount is one band copy.
+    void reuse(int lineHeight, size_t painted) {
+        stale.assign(stale.size(), 1);
+        if (damaged) return;
+        struct Band {
+            size_t from,to,count;
+        };
+        std::vector<Band> bands;
+        bool moved = false;
+        for (size_t i = 0, j = 0; i < next.size() && j < rows.size();) {
+            if (!rows[j].valid || rows[j] < next[i]) {
+                j++;
+            } else if (next[i] < rows[j]) {
+                i++;
+            } else {
+                if (next[i].samePixels(rows[j])) {
+                    if (!bands.empty() && bands.back().from + bands.back().count == j && bands.back().to + bands.back().count == i) {
+                        bands.back().count++;
+                    } else {
+                        bands.push_back({j, i, 1});
+                    }
+                    moved = moved || i != j;
+                    stale[i] = 0;
+                }
+                i++;
+                j++;
+            }
+        }
+        if (!moved) {
+            // Blank rows past the end of the text are still blank.
+            for (size_t r = std::max(next.size(), rows.size()); r < std::min(painted, stale.size()); r++) stale[r] = 0;
+        }
+        for (const Band& b : bands) {
+            if (moved) t.move(b.from * lineHeight, b.to * lineHeight, b.count * lineHeight);
+        }
+        // The strip below the last whole row isn't in any band, and moves
+        // with the bottom edge.
+        if ((moved && t.Height() % lineHeight) || t.Height() != paintedHeight) stale.back() = 1;
+    }
+    // Repaints the stale rows in layers (background, selection, cursor,
+    // text) so each layer goes out as one batch.
+    template<class Metrics>
+    void rasterize(const Metrics& m, int lineHeight) {
+        size_t texts = 0, fetched = NONE;
+        for (size_t r = 0; r < next.size(); r++) {
+            if (!stale[r]) continue;
+            if (next[r].line != fetched) {
+                if (texts == lineTexts.size()) lineTexts.emplace_back();
+                doc.lineText(next[r].line, lineTexts[texts++]);
+                fetched = next[r].line;
+            }
+            next[r].text = texts - 1;
+        }
+        if (std::find(stale.begin(), stale.end(), 0) == stale.end()) {
+            t.clear(bg);
+        } else {
+            t.setColor(bg);
+            for (size_t r = 0; r < stale.size(); r++) {
+                int y = r * lineHeight;
+                if (stale[r]) t.fillRect(0, y, t.Width(), r + 1 == stale.size() ? t.Height() - y : lineHeight);
+            }
+        }
+        t.setColor(selectionColor);
+        for (size_t r = 0; r < next.size(); r++) {
+            const Row& row = next[r];
+            if (!stale[r] || row.selBegin == row.selEnd) continue;
+            const std::string& text = lineTexts[row.text];
+            int x = m.x(text, row.begin, row.selBegin);
+            t.fillRect(x, r * lineHeight, m.x(text, row.begin, row.selEnd) - x, lineHeight);
+        }
+        t.setColor(fg);
+        for (size_t r = 0; r < next.size(); r++) {
+            const Row& row = next[r];
+            if (stale[r] && row.cursor != NONE) t.drawRect(m.x(lineTexts[row.text], row.begin, row.cursor), r * lineHeight, 2, lineHeight);
+        }
+        for (size_t r = 0; r < next.size(); r++) {
+            const Row& row = next[r];
+            if (stale[r]) t.queueText(fontIndex, lineTexts[row.text].data() + row.begin, row.end - row.begin, 0, r * lineHeight, fg);
+        }
+    }
+    template<class Metrics>
+    void render(const Metrics& m) {
+        Timer timer(false);
+        int lineHeight = t.getMetrics(fontIndex).lineHeight;
+        if (lineHeight <= 0) return;
+        size_t capacity = std::max(1, t.Height() / lineHeight);
+        size_t overscan = (t.Height() - viewHeight) / 2 / lineHeight;
+        size_t viewRows = (viewHeight + lineHeight - 1) / lineHeight;
+        layout.setWidth(viewWidth);
+        // Keep the texture's first line while the view stays inside it.
+        long at = -1;
+        if (!rows.empty() && rows[0].valid && rows[0].begin == 0 && rows[0].line <= topLine) {
+            layoutRows(m, rows[0].line, capacity);
+            at = rowOf(topLine);
+        }
+        bool covered = at >= 0 && at * lineHeight + viewHeight <= t.Height() &&
+            (at + viewRows <= next.size() || (next.back().last && next.back().line + 1 == doc.lineCount()));
+        if (!covered) {
+            size_t first = topLine, above = 0;
+            while (first > 0) {
+                size_t n = breaksOf(first - 1, m).size() + 1;
+                if (above + n > overscan) break;
+                above += n;
+                first--;
+            }
+            layoutRows(m, first, capacity);
+            at = above;
+        }
+        decorate();
+        size_t painted = stale.size();
+        stale.resize(capacity);
+        reuse(lineHeight, painted);
+        Profiler::instance().zone(ZONE_LAYOUT).add(timer.nanos());
+        if (std::find(stale.begin(), stale.end(), 1) != stale.end()) {
+            ScopedZone zone(ZONE_RASTER);
+            rasterize(m, lineHeight);
+        }
+        rows.swap(next);
+        layout.retain(rows[0].line, rows[0].line + capacity, 4 * capacity);
+        viewRow = at;
+        paintedHeight = t.Height();
+        damaged = false;
+    }
+    // Font size in drawable pixels: fontSize is in points.
+    int scaledFontSize() {
+        if (pointWidth <= 0 || pixelWidth <= 0) return fontSize;
+        return std::max(1, (int)std::lround(fontSize * (double)pixelWidth / pointWidth));
+    }
+    // Follows the window's drawable size, which SDL_WINDOWEVENT_SIZE_CHANGED
+    // keeps current. Nothing is laid out here: lines reflow for the new
+    // width as they come into view, and rows whose wrapping didn't change
+    // keep their pixels unless the texture was reallocated or widened.
+    void fit() {
+        int w = pixelWidth, h = pixelHeight;
+        if (w <= 0 || h <= 0) return;
+        int px = scaledFontSize();
+        if (px != pixelFontSize) {
+            pixelFontSize = px;
+            fontIndex = t.reloadFont(fontIndex, fontPath, pixelFontSize);
+            layout.clear();
+            damaged = dirty = true;
+        }
+        if (w == viewWidth && h == viewHeight) return;
+        if (t.resize(w, h + 2 * (int)(h * OVERSCAN)) || w > viewWidth) damaged = true;
+        viewWidth = w;
+        viewHeight = h;
+        lastCursor = {-1, -1};
+        dirty = true;
+    }
+public:
+    // After window->createRenderer().
+    TextView(Window* w,Document d,const std::string& path,int size,int width,int height):
+        window(w),fontSize(size),fontPath(path),doc(std::move(d)),t(w->getRenderer(),width,height+2*(int)(height*OVERSCAN)),
+        viewWidth(width),viewHeight(height),pointWidth(width),pointHeight(height),
+        pixelWidth(w->PixelWidth()),pixelHeight(w->PixelHeight()) {
+        pixelFontSize=scaledFontSize();
+        fontIndex=t.loadFont(fontPath,pixelFontSize);
+    }
+    // Takes in one snapshot; a run of them has to be applied in order.
+    void apply(const BufferSnapshot& s) {
+        doc.apply(s);
+        layout.apply(s.edits);
+        for (const LineEdit& e : s.edits) apply(e);
+        if (s.moved) {
+            blinkStart = SDL_GetTicks();
+            dirty = true;
+        }
+        scrollY += s.scrollY;
+        // A window event can change the drawable size without the size in
+        // points, as when the window moves to a display of another scale.
+        if (s.exposed) {
+            pointWidth = s.width;
+            pointHeight = s.height;
+            pixelWidth = s.pixelWidth;
+            pixelHeight = s.pixelHeight;
+            dirty = true;
+        }
+    }
+    void update() {
+        fit();
+        scroll();
+        blink();
+    }
+    void glyphStats(size_t& hits, size_t& misses) {
+        t.glyphStats(hits, misses);
+    }
+    bool needsRender() {
+        return dirty;
+    }
+    // Milliseconds until the view changes on its own (the next cursor
+    // blink), -1 if it doesn't.
+    int nextDeadline() {
+        if (window->isHeadless()) return -1;
+        return BLINK_MS - (SDL_GetTicks() - blinkStart) % BLINK_MS;
+    }
+    // Lays out and records the rows that changed; nothing reaches the
+    // renderer until draw.
+    void prepare() {
+        if (t.getFont(fontIndex)) withMetrics(t.getMetrics(fontIndex), [&](const auto& m) { render(m); });
+        dirty = false;
+    }
+    // On the window's thread.
+    void draw() {
+        int y = viewRow * t.getMetrics(fontIndex).lineHeight;
+        ScopedZone zone(ZONE_DRAW);
+        window->drawTexture(t, {0, y, viewWidth, viewHeight}, {0, 0, viewWidth, viewHeight});
+    }
+};
+#endif
@@ -3,16 +3,23 @@
 #include <chrono>
 #include <iostream>
 
+// Time since construction on the monotonic clock. A reporting Timer prints
+// it when it goes out of scope; a quiet one is just a stopwatch.
 class Timer {
-    using clock = std::chrono::high_resolution_clock;
+    using clock = std::chrono::steady_clock;
     clock::time_point start_time;
+    bool report;
 public:
-    Timer() : start_time(clock::now()) {}
+    Timer(bool report = true) : start_time(clock::now()), report(report) {}
     int now() {
         auto end_time = clock::now();
         return std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
     }
+    long long nanos() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_time).count();
+    }
     ~Timer() {
+        if (!report) return;
         auto end_time = clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
         std::cout << "Time Taken: " << duration.count() << " ms" << std::endl;
@@ -0,0 +1,159 @@
+#ifndef TRACE
+#define TRACE
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Begin/end/counter events in a ring per thread, written as Chrome trace
+// JSON (chrome://tracing, ui.perfetto.dev) on request. Recording is a few
+// relaxed stores into the calling thread's own ring, so it is lock-free and
+// cheap enough to leave on; the mutex is only taken the first time a thread
+// records and while dumping. Build with -DFATE_TRACE=0 and the TRACE_
+// macros compile to nothing.
+#ifndef FATE_TRACE
+#define FATE_TRACE 1
+#endif
+
+class Tracer {
+    using clock = std::chrono::steady_clock;
+    // Slots are atomics so a dump can read a ring its thread is writing.
+    // Names must be string literals or otherwise outlive the tracer.
+    struct Event {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<long long> ns{0};
+        std::atomic<long long> value{0};
+        std::atomic<char> phase{0};
+    };
+    struct Ring {
+        static constexpr size_t SIZE=1<<16;
+        Event events[SIZE];
+        std::atomic<size_t> head{0};
+        int tid;
+        std::string name;
+    };
+    clock::time_point origin=clock::now();
+    std::mutex mutex;
+    std::vector<Ring*> rings;
+    Tracer() {}
+    Ring& ring() {
+        thread_local Ring* mine=nullptr;
+        if (!mine) {
+            std::lock_guard<std::mutex> lock(mutex);
+            mine=new Ring();
+            mine->tid=rings.size()+1;
+            mine->name="thread "+std::to_string(mine->tid);
+            rings.push_back(mine);
+        }
+        return *mine;
+    }
+    void record(char phase,const char* name,long long value) {
+        Ring& r=ring();
+        size_t h=r.head.load(std::memory_order_relaxed);
+        Event& e=r.events[h%Ring::SIZE];
+        e.name.store(name,std::memory_order_relaxed);
+        e.ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-origin).count(),std::memory_order_relaxed);
+        e.value.store(value,std::memory_order_relaxed);
+        e.phase.store(phase,std::memory_order_relaxed);
+        r.head.store(h+1,std::memory_order_release);
+    }
+    static void writeName(FILE* out,const char* name) {
+        for (const char* c=name;*c;c++) {
+            if (*c=='"'||*c=='\\') fputc('\\',out);
+            if ((unsigned char)*c>=' ') fputc(*c,out);
+        }
+    }
+public:
+    Tracer(const Tracer&)=delete;
+    Tracer& operator=(const Tracer&)=delete;
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+    void begin(const char* name) {
+        record('B',name,0);
+    }
+    void end(const char* name) {
+        record('E',name,0);
+    }
+    void counter(const char* name,long long value) {
+        record('C',name,value);
+    }
+    // Names the calling thread in dumps.
+    void nameThread(const std::string& name) {
+        Ring& r=ring();
+        std::lock_guard<std::mutex> lock(mutex);
+        r.name=name;
+    }
+    // Writes what the rings still hold. Events a thread overwrote while
+    // they were being copied are dropped, as are ends whose begin already
+    // fell out of the ring.
+    bool dump(const std::string& path) {
+        FILE* out=fopen(path.c_str(),"w");
+        if (!out) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        fprintf(out,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first=true;
+        for (Ring* r:rings) {
+            fprintf(out,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",first?"":",\n",r->tid);
+            writeName(out,r->name.c_str());
+            fprintf(out,"\"}}");
+            first=false;
+            size_t end=r->head.load(std::memory_order_acquire);
+            size_t begin=end>Ring::SIZE?end-Ring::SIZE:0;
+            int depth=0;
+            for (size_t i=begin;i<end;i++) {
+                const Event& e=r->events[i%Ring::SIZE];
+                const char* name=e.name.load(std::memory_order_relaxed);
+                long long ns=e.ns.load(std::memory_order_relaxed);
+                long long value=e.value.load(std::memory_order_relaxed);
+                char phase=e.phase.load(std::memory_order_relaxed);
+                if (r->head.load(std::memory_order_acquire)-i>=Ring::SIZE) continue;
+                if (!name) continue;
+                if (phase=='B') depth++;
+                if (phase=='E'&&depth==0) continue;
+                if (phase=='E') depth--;
+                fprintf(out,",\n{\"name\":\"");
+                writeName(out,name);
+                fprintf(out,"\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":1,\"tid\":%d",phase,ns/1000,ns%1000,r->tid);
+                if (phase=='C') fprintf(out,",\"args\":{\"value\":%lld}",value);
+                fprintf(out,"}");
+            }
+        }
+        fprintf(out,"\n]}\n");
+        return fclose(out)==0;
+    }
+};
+
+// Begin on construction, end on destruction.
+class TraceScope {
+    const char* name;
+public:
+    TraceScope(const char* name): name(name) {
+        Tracer::instance().begin(name);
+    }
+    TraceScope(const TraceScope&)=delete;
+    TraceScope& operator=(const TraceScope&)=delete;
+    ~TraceScope() {
+        Tracer::instance().end(name);
+    }
+};
+
+#define TRACE_CONCAT2(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT2(a,b)
+#if FATE_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope,__LINE__)(name)
+#define TRACE_BEGIN(name) Tracer::instance().begin(name)
+#define TRACE_END(name) Tracer::instance().end(name)
+#define TRACE_COUNTER(name,value) Tracer::instance().counter(name,value)
+#define TRACE_THREAD(name) Tracer::instance().nameThread(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_COUNTER(name,value) do {} while (0)
+#define TRACE_THREAD(name) do {} while (0)
+#endif
+#endif